@@ -0,0 +1,295 @@
+#include <thread>
+#include <sstream>
+#include <cctype>
+#include <algorithm>
+#include <filesystem>
+#include "analyzer.h"
+#include "train.h"
+
+const int	ANALYZE_MOVE_NUM = 5;
+const int	ANALYZE_REPORT_INTERVAL = 1000;	// positions between progress lines
+
+AnalyzerOptions::AnalyzerOptions()
+{
+	concurrency = 0;
+	moveNum = ANALYZE_MOVE_NUM;
+	workerNum = 0;
+	memoryLimit = 0;
+}
+
+bool AnalyzerOptions::Set(const string &key, const string &value)
+{
+	if (key == "concurrency")
+		concurrency = stoi(value);
+	else if (key == "moves")
+		moveNum = max(stoi(value), 1);
+	else if (key == "workers")
+		workerNum = stoi(value);
+	else if (key == "memory")
+		memoryLimit = stoi(value);
+	else
+		return false;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Analyzer::Analyzer(const MCTSConfig &config, const AnalyzerOptions &options)
+{
+	this->config = config;
+	this->options = options;
+
+	// search logs of concurrent positions would overwrite each other
+	this->config.logLevel = E_LOG_NONE;
+
+	nextIndex = 0;
+	doneWatermark = 0;
+	resultFile = NULL;
+	analyzed = skipped = failed = 0;
+}
+
+Analyzer::~Analyzer()
+{
+	if (resultFile != NULL)
+		fclose(resultFile);
+}
+
+bool Analyzer::Run(const string &inputFile, const string &outputFile)
+{
+	inputStream.open(inputFile);
+	if (!inputStream.is_open())
+	{
+		printf("analyze: cannot open %s\n", inputFile.c_str());
+		return false;
+	}
+
+	if (!LoadProgress(outputFile) || fopen_s(&resultFile, outputFile.c_str(), "ab") != 0)
+	{
+		printf("analyze: cannot write %s\n", outputFile.c_str());
+		return false;
+	}
+
+	SearchScheduler &scheduler = SearchScheduler::Instance();
+	scheduler.Configure(options.workerNum, options.memoryLimit);
+	int concurrency = (options.concurrency > 0) ? options.concurrency : scheduler.GetWorkerNum();
+
+	printf("analyze: %s -> %s (%s), %d concurrent positions on %d workers, %d already done\n", inputFile.c_str(), outputFile.c_str(),
+		config.ToString().c_str(), concurrency, scheduler.GetWorkerNum(), doneWatermark + (int)doneIndices.size());
+
+	TimePoint startTime = chrono::steady_clock::now();
+	vector<thread> threads;
+	for (int i = 0; i < concurrency; ++i)
+		threads.push_back(thread(WorkerThread, this));
+
+	for (auto &t : threads)
+		t.join();
+
+	float time = GetElapsedTime(startTime);
+	printf("analyze finish: %d analyzed, %d failed, %d skipped, %.1f s, %.1f positions/s\n", analyzed, failed, skipped, time, analyzed / max(time, 1e-3f));
+	return true;
+}
+
+void Analyzer::WorkerThread(Analyzer *analyzer)
+{
+	MCTS ai(0, analyzer->config);
+
+	int index;
+	string line;
+	while (analyzer->NextPosition(index, line))
+	{
+		string result = analyzer->Analyze(ai, line);
+		analyzer->WriteResult(index, result);
+	}
+}
+
+bool Analyzer::NextPosition(int &index, string &line)
+{
+	lock_guard<mutex> lock(inputMtx);
+	while (getline(inputStream, line))
+	{
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos || line[start] == '#')
+			continue;
+
+		index = nextIndex++;
+		if (IsDone(index))
+		{
+			++skipped;
+			continue;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool Analyzer::IsDone(int index)
+{
+	// indices only grow, resumed ones behind the reader are no longer needed
+	while (!doneIndices.empty() && *doneIndices.begin() < index)
+		doneIndices.erase(doneIndices.begin());
+
+	return index < doneWatermark || doneIndices.count(index) > 0;
+}
+
+bool Analyzer::LoadProgress(const string &outputFile)
+{
+	ifstream stream(outputFile, ios::binary);
+	if (!stream.is_open())
+		return true;
+
+	// a line cut by an interrupted run is dropped, its position is searched again
+	string line;
+	long long completeSize = 0;
+	while (getline(stream, line) && !stream.eof())
+	{
+		completeSize += line.size() + 1;
+
+		size_t tab = line.find('\t');
+		if (tab == string::npos || tab == 0 || !all_of(line.begin(), line.begin() + tab, [](char c) { return isdigit((unsigned char)c) != 0; }))
+			continue;
+
+		MarkDone(stoi(line.substr(0, tab)));
+	}
+	stream.close();
+
+	error_code error;
+	if ((long long)filesystem::file_size(outputFile, error) != completeSize)
+		filesystem::resize_file(outputFile, completeSize, error);
+	return !error;
+}
+
+void Analyzer::MarkDone(int index)
+{
+	// results come back nearly in order, the set only holds those ahead of the watermark
+	if (index >= doneWatermark)
+		doneIndices.insert(index);
+
+	while (!doneIndices.empty() && *doneIndices.begin() == doneWatermark)
+	{
+		doneIndices.erase(doneIndices.begin());
+		++doneWatermark;
+	}
+}
+
+void Analyzer::WriteResult(int index, const string &text)
+{
+	lock_guard<mutex> lock(outputMtx);
+
+	// one write per line, a killed process leaves at most one partial line
+	string line = to_string(index) + "\t" + text + "\n";
+	fwrite(line.data(), 1, line.size(), resultFile);
+	fflush(resultFile);
+
+	if (text.compare(0, 5, "error") == 0)
+		++failed;
+	else
+		++analyzed;
+
+	if ((analyzed + failed) % ANALYZE_REPORT_INTERVAL == 0)
+	{
+		printf("analyze: %d analyzed, %d failed\n", analyzed, failed);
+		fflush(stdout);
+	}
+}
+
+string Analyzer::Analyze(MCTS &ai, const string &line)
+{
+	Game game;
+	string error;
+	if (!ParsePosition(line, game, error))
+		return "error\t" + error;
+
+	if (game.IsGameFinish())
+		return "end";
+
+	if (game.GetState() == GameBase::E_PASS)
+		return "pass";
+
+	// the tree is gone once Search returns, the result is taken when the move is known
+	SearchInfo info;
+	bool hasInfo = false;
+	ai.SetMoveCallback([&](int) { hasInfo = ai.GetSearchInfo(info, options.moveNum); });
+	int move = ai.Search(&game);
+	ai.SetMoveCallback(nullptr);
+
+	if (!hasInfo)
+		return "error\tno search result";
+
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%s\t%.2f\t%d\t", Game::Id2Str(move).c_str(), info.winRate * 100, info.visit);
+	string text = buffer;
+
+	for (size_t i = 0; i < info.pv.size(); ++i)
+		text += (i > 0 ? " " : "") + Game::Id2Str(info.pv[i]);
+
+	text += "\t";
+	for (size_t i = 0; i < info.moves.size(); ++i)
+	{
+		snprintf(buffer, sizeof(buffer), "%s%s:%d:%.2f", (i > 0) ? " " : "", Game::Id2Str(info.moves[i]).c_str(), info.moveVisits[i], info.moveWinRates[i] * 100);
+		text += buffer;
+	}
+	return text;
+}
+
+bool Analyzer::ParsePosition(const string &line, Game &game, string &error)
+{
+	stringstream ss(line);
+	string board, side;
+	ss >> board >> side;
+
+	// 32 moves written together are 64 characters as well, but boards have no digits
+	bool isBoard = board.size() == GRID_NUM && none_of(board.begin(), board.end(), [](char c) { return isdigit((unsigned char)c) != 0; });
+	if (!isBoard)
+	{
+		// a move sequence from the start position, passes are implied
+		vector<uint8_t> moves;
+		if (!RecordReader::ParseRecord(line, moves))
+		{
+			error = "bad position";
+			return false;
+		}
+
+		game.Reset();
+		for (auto move : moves)
+		{
+			if (game.GetState() == GameBase::E_PASS)
+				game.PutChess(-1);
+
+			if (game.GetState() != GameBase::E_NORMAL || !game.PutChess(move))
+			{
+				error = "illegal move " + Game::Id2Str(move);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	array<char, GRID_NUM> grids;
+	for (int id = 0; id < GRID_NUM; ++id)
+	{
+		char c = toupper((unsigned char)board[id]);
+		if (c == 'X' || c == 'B' || c == '*')
+			grids[id] = Board::E_BLACK;
+		else if (c == 'O' || c == 'W')
+			grids[id] = Board::E_WHITE;
+		else if (c == '-' || c == '.')
+			grids[id] = Board::E_EMPTY;
+		else
+		{
+			error = "bad board";
+			return false;
+		}
+	}
+
+	side.erase(remove(side.begin(), side.end(), ';'), side.end());
+	transform(side.begin(), side.end(), side.begin(), ::toupper);
+
+	int sideValue = (side == "X" || side == "B" || side == "BLACK") ? Board::E_BLACK : ((side == "O" || side == "W" || side == "WHITE") ? Board::E_WHITE : Board::E_EMPTY);
+	if (!game.SetPosition(grids, sideValue))
+	{
+		error = "bad side to move";
+		return false;
+	}
+	return true;
+}
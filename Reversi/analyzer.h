@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include "mcts.h"
+
+class AnalyzerOptions
+{
+public:
+	AnalyzerOptions();
+	bool Set(const string &key, const string &value);
+
+	int concurrency;	// positions searched at the same time, 0: one per worker
+	int moveNum;		// root moves listed per result
+	int workerNum;		// search threads shared by all positions, 0: one per hardware thread
+	int memoryLimit;	// MB of all search trees together, 0: scheduler default
+};
+
+// Streams positions from a text file through concurrent searches, one per line:
+// a GRID_NUM character board ("X"/"B"/"*" black, "O"/"W" white, "-"/"." empty, row
+// by row from A1) followed by the side to move, or a move sequence from the
+// start position such as "F5D6C3". Blank lines and "#" comments are skipped.
+// A tab separated result "index move winrate visits pv moves" is appended to
+// the output as soon as its search ends, index counts the positions of the input.
+// Positions already in the output are skipped, so an interrupted run resumes
+// with the same command. Only the positions being searched are held in memory.
+class Analyzer
+{
+public:
+	Analyzer(const MCTSConfig &config, const AnalyzerOptions &options);
+	~Analyzer();
+	bool Run(const string &inputFile, const string &outputFile);
+
+	static bool ParsePosition(const string &line, Game &game, string &error);
+
+private:
+	static void WorkerThread(Analyzer *analyzer);
+
+	bool NextPosition(int &index, string &line);
+	bool IsDone(int index);
+	bool LoadProgress(const string &outputFile);
+	void MarkDone(int index);
+	void WriteResult(int index, const string &text);
+	string Analyze(MCTS &ai, const string &line);
+
+	MCTSConfig config;
+	AnalyzerOptions options;
+
+	ifstream inputStream;
+	int nextIndex;
+	mutex inputMtx;
+
+	// indices in the output: all below doneWatermark and the few above it
+	int doneWatermark;
+	set<int> doneIndices;
+
+	FILE *resultFile;
+	int analyzed, skipped, failed;
+	mutex outputMtx;
+};
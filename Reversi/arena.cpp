@@ -0,0 +1,328 @@
+#include <thread>
+#include <cmath>
+#include <random>
+#include <set>
+#include <functional>
+#include <algorithm>
+#include "arena.h"
+
+const int	ARENA_MAX_GAMES = 20000;
+const int	ARENA_OPENING_PLIES = 4;
+const float	ARENA_ELO0 = 0.f;
+const float	ARENA_ELO1 = 10.f;
+const float	ARENA_ALPHA = 0.05f;
+const float	ARENA_BETA = 0.05f;
+const int	ARENA_OPENING_SEED = 20191228;
+
+ArenaOptions::ArenaOptions()
+{
+	maxGames = ARENA_MAX_GAMES;
+	concurrency = 0;
+	openingPlies = ARENA_OPENING_PLIES;
+	elo0 = ARENA_ELO0;
+	elo1 = ARENA_ELO1;
+	alpha = ARENA_ALPHA;
+	beta = ARENA_BETA;
+	workerNum = 0;
+	memoryLimit = 0;
+	firstOpening = 0;
+	isQuiet = false;
+}
+
+bool ArenaOptions::Set(const string &key, const string &value)
+{
+	if (key == "games")
+		maxGames = stoi(value);
+	else if (key == "concurrency")
+		concurrency = stoi(value);
+	else if (key == "plies")
+		openingPlies = stoi(value);
+	else if (key == "elo0")
+		elo0 = stof(value);
+	else if (key == "elo1")
+		elo1 = stof(value);
+	else if (key == "alpha")
+		alpha = stof(value);
+	else if (key == "beta")
+		beta = stof(value);
+	else if (key == "record")
+		recordFile = value;
+	else if (key == "db")
+		gameDbFile = value;
+	else if (key == "workers")
+		workerNum = stoi(value);
+	else if (key == "memory")
+		memoryLimit = stoi(value);
+	else if (key == "opening")
+		firstOpening = max(stoi(value), 0);
+	else if (key == "quiet")
+		isQuiet = stoi(value) != 0;
+	else
+		return false;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Arena::Arena(const ArenaEngine &engine1, const ArenaEngine &engine2, const ArenaOptions &options)
+{
+	engines[0] = engine1;
+	engines[1] = engine2;
+	this->options = options;
+
+	// search logs of concurrent games would overwrite each other
+	engines[0].config.logLevel = E_LOG_NONE;
+	engines[1].config.logLevel = E_LOG_NONE;
+
+	win = loss = draw = 0;
+	finishedGames = 0;
+	nextGame = 0;
+	verdict = E_UNDECIDED;
+}
+
+int Arena::Run()
+{
+	GenerateOpenings();
+	SearchScheduler::Instance().Configure(options.workerNum, options.memoryLimit);
+
+	if (!options.recordFile.empty())
+		recordStream.open(options.recordFile, ios::app);
+
+	if (!options.gameDbFile.empty() && !gameDb.Open(options.gameDbFile))
+		printf("arena: cannot open game database %s\n", options.gameDbFile.c_str());
+
+	int concurrency = options.concurrency;
+	if (concurrency <= 0)
+	{
+		int engineThreads = max(max(engines[0].config.threadNum, engines[1].config.threadNum), 1);
+		concurrency = max((int)thread::hardware_concurrency() / engineThreads, 1);
+	}
+
+	if (!options.isQuiet)
+	{
+		printf("arena: %s (%s) vs %s (%s)\n", engines[0].name.c_str(), engines[0].config.ToString().c_str(), engines[1].name.c_str(), engines[1].config.ToString().c_str());
+		printf("arena: %d openings, %d concurrent games on %d workers, sprt elo0=%.1f elo1=%.1f alpha=%.2f beta=%.2f\n", (int)openings.size(), concurrency, SearchScheduler::Instance().GetWorkerNum(), options.elo0, options.elo1, options.alpha, options.beta);
+	}
+
+	vector<thread> threads;
+	for (int i = 0; i < concurrency; ++i)
+		threads.push_back(thread(WorkerThread, this));
+
+	for (auto &t : threads)
+		t.join();
+
+	double elo, error;
+	CalcEloError(elo, error);
+
+	const char *verdictText[] = { "undecided", "H0 accepted", "H1 accepted" };
+	if (!options.isQuiet)
+		printf("arena finish: %d games, +%d -%d =%d, elo %.1f +- %.1f, %s\n", finishedGames, win, loss, draw, elo, error, verdictText[verdict]);
+
+	return verdict;
+}
+
+void Arena::WorkerThread(Arena *arena)
+{
+	MCTS mcts[2] = { MCTS(0, arena->engines[0].config), MCTS(0, arena->engines[1].config) };
+	vector<uint8_t> record;
+
+	while (arena->verdict == E_UNDECIDED)
+	{
+		int gameId = arena->nextGame++;
+		if (gameId >= arena->options.maxGames)
+			break;
+
+		// every opening is played twice with colors swapped
+		int opening = (arena->options.firstOpening + gameId / 2) % arena->openings.size();
+		bool engine1Black = (gameId % 2 == 0);
+
+		MCTS &black = engine1Black ? mcts[0] : mcts[1];
+		MCTS &white = engine1Black ? mcts[1] : mcts[0];
+		int state = arena->PlayGame(black, white, arena->openings[opening], record);
+
+		arena->ReportResult(gameId, opening, engine1Black, state, record);
+	}
+}
+
+int Arena::PlayGame(MCTS &black, MCTS &white, const vector<uint8_t> &opening, vector<uint8_t> &record)
+{
+	Game g;
+	for (auto move : opening)
+		g.PutChess(move);
+
+	while (!g.IsGameFinish())
+	{
+		MCTS &ai = (g.GetTurn() % 2 == 1) ? black : white;
+		int move = ai.Search(&g);
+		if (!g.PutChess(move))
+			break;
+	}
+
+	record = g.GetRecord();
+	return g.GetState();
+}
+
+void Arena::ReportResult(int gameId, int opening, bool engine1Black, int state, const vector<uint8_t> &record)
+{
+	lock_guard<mutex> lock(resultMtx);
+
+	const char *resultText = "1/2-1/2";
+	if (state == GameBase::E_DRAW)
+	{
+		++draw;
+	}
+	else
+	{
+		bool blackWin = (state == GameBase::E_BLACK_WIN);
+		resultText = blackWin ? "1-0" : "0-1";
+
+		if (blackWin == engine1Black)
+			++win;
+		else
+			++loss;
+	}
+	++finishedGames;
+
+	if (recordStream.is_open())
+	{
+		for (auto move : record)
+		{
+			if (move < GRID_NUM) // passes are implied by the position
+				recordStream << Game::Id2Str(move);
+		}
+		recordStream << endl;
+	}
+
+	if (gameDb.IsOpen())
+	{
+		const ArenaEngine &blackEngine = engines[engine1Black ? 0 : 1];
+		const ArenaEngine &whiteEngine = engines[engine1Black ? 1 : 0];
+		gameDb.Append(record, blackEngine.name + " " + blackEngine.config.ToString(), whiteEngine.name + " " + whiteEngine.config.ToString());
+	}
+
+	double elo, error;
+	CalcEloError(elo, error);
+	double llr = CalcLLR(win, loss, draw, options.elo0, options.elo1);
+	double lowerBound = log(options.beta / (1 - options.alpha));
+	double upperBound = log((1 - options.beta) / options.alpha);
+
+	const char *name1 = engines[engine1Black ? 0 : 1].name.c_str();
+	const char *name2 = engines[engine1Black ? 1 : 0].name.c_str();
+	if (!options.isQuiet)
+	{
+		printf("game %d (opening %d): %s - %s %s | +%d -%d =%d | elo %.1f +- %.1f | llr %.2f (%.2f, %.2f)\n",
+			gameId, opening, name1, name2, resultText, win, loss, draw, elo, error, llr, lowerBound, upperBound);
+		fflush(stdout);
+	}
+
+	if (llr >= upperBound)
+		verdict = E_ACCEPT_H1;
+	else if (llr <= lowerBound)
+		verdict = E_ACCEPT_H0;
+}
+
+void Arena::GenerateOpenings()
+{
+	// positions symmetric by the start position are played only once
+	auto canonicalKey = [](GameBase &game)
+	{
+		string best;
+		for (int t = 0; t < 4; ++t)
+		{
+			string key(GRID_NUM, 0);
+			for (int row = 0; row < BOARD_SIZE; ++row)
+			{
+				for (int col = 0; col < BOARD_SIZE; ++col)
+				{
+					int r = row, c = col;
+					if (t & 1)
+						swap(r, c);
+					if (t & 2)
+					{
+						r = BOARD_SIZE - 1 - r;
+						c = BOARD_SIZE - 1 - c;
+					}
+					key[Board::Coord2Id(r, c)] = game.board.GetGrid(Board::Coord2Id(row, col));
+				}
+			}
+			if (best.empty() || key < best)
+				best = key;
+		}
+		return best;
+	};
+
+	openings.clear();
+	set<string> visited;
+	vector<uint8_t> moves;
+
+	// depth first over all move sequences, GameBase keeps only top priority grids
+	// so the opening set has to be built from the full legal move list
+	function<void(GameBase&)> expand = [&](GameBase &game)
+	{
+		if ((int)moves.size() == options.openingPlies || game.IsGameFinish())
+		{
+			if (visited.insert(canonicalKey(game)).second)
+				openings.push_back(moves);
+			return;
+		}
+
+		for (int id = 0; id < GRID_NUM; ++id)
+		{
+			if (game.board.GetGrid(id) != Board::E_EMPTY || game.board.GetGridType(id) != Board::E_VALID_TYPE)
+				continue;
+
+			GameBase next = game;
+			next.PutChess(id);
+			moves.push_back(id);
+			expand(next);
+			moves.pop_back();
+		}
+	};
+
+	GameBase start;
+	expand(start);
+
+	shuffle(openings.begin(), openings.end(), mt19937(ARENA_OPENING_SEED));
+}
+
+void Arena::CalcEloError(double &elo, double &error)
+{
+	int games = win + loss + draw;
+	if (games == 0)
+	{
+		elo = error = 0;
+		return;
+	}
+
+	double score = (win + draw * 0.5) / games;
+	double variance = (win * pow(1 - score, 2) + draw * pow(0.5 - score, 2) + loss * pow(score, 2)) / games;
+	double margin = 1.96 * sqrt(variance / games);
+
+	elo = CalcElo(score);
+	error = (CalcElo(min(score + margin, 0.999)) - CalcElo(max(score - margin, 0.001))) / 2;
+}
+
+double Arena::CalcElo(double score)
+{
+	score = min(max(score, 0.001), 0.999);
+	return -400 * log10(1 / score - 1);
+}
+
+double Arena::CalcLLR(int win, int loss, int draw, double elo0, double elo1)
+{
+	// generalized sprt with normal approximation of the game score
+	int games = win + loss + draw;
+	if (games == 0 || win + draw == 0 || loss + draw == 0)
+		return 0;
+
+	double score = (win + draw * 0.5) / games;
+	double variance = (win * pow(1 - score, 2) + draw * pow(0.5 - score, 2) + loss * pow(score, 2)) / games;
+	if (variance <= 0)
+		return 0;
+
+	double s0 = 1 / (1 + pow(10, -elo0 / 400));
+	double s1 = 1 / (1 + pow(10, -elo1 / 400));
+
+	return games * (s1 - s0) * (2 * score - s0 - s1) / (2 * variance);
+}
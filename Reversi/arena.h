@@ -0,0 +1,71 @@
+#pragma once
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include "mcts.h"
+#include "gamedb.h"
+
+class ArenaEngine
+{
+public:
+	string name;
+	MCTSConfig config;
+};
+
+class ArenaOptions
+{
+public:
+	ArenaOptions();
+	bool Set(const string &key, const string &value);
+
+	int maxGames;		// upper bound of games, sprt may stop earlier
+	int concurrency;	// games played at the same time, 0: one per hardware thread
+	int openingPlies;	// depth of the balanced opening set
+	float elo0, elo1;	// sprt hypotheses
+	float alpha, beta;	// sprt error rates
+	string recordFile;	// game records are appended here if not empty
+	string gameDbFile;	// game database the games are appended to if not empty
+	int workerNum;		// search threads shared by all games, 0: one per hardware thread
+	int memoryLimit;	// MB of all search trees together, 0: scheduler default
+	int firstOpening;	// openings are played from this one on, wrapping around
+	bool isQuiet;		// no output, the caller reads the result
+};
+
+class Arena
+{
+public:
+	enum Verdict
+	{
+		E_UNDECIDED,
+		E_ACCEPT_H0,
+		E_ACCEPT_H1,
+	};
+
+	Arena(const ArenaEngine &engine1, const ArenaEngine &engine2, const ArenaOptions &options);
+	int Run();
+
+	// game results from the view of engine1
+	int win, loss, draw;
+
+	static double CalcElo(double score);
+	static double CalcLLR(int win, int loss, int draw, double elo0, double elo1);
+
+private:
+	static void WorkerThread(Arena *arena);
+
+	void GenerateOpenings();
+	int PlayGame(MCTS &black, MCTS &white, const vector<uint8_t> &opening, vector<uint8_t> &record);
+	void ReportResult(int gameId, int opening, bool engine1Black, int state, const vector<uint8_t> &record);
+	void CalcEloError(double &elo, double &error);
+
+	ArenaEngine engines[2];
+	ArenaOptions options;
+
+	vector<vector<uint8_t>> openings;
+	atomic<int> nextGame;
+	atomic<int> verdict;
+	int finishedGames;
+	ofstream recordStream;
+	GameDbWriter gameDb;
+	mutex resultMtx;
+};
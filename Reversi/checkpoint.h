@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "game.h"
+
+using namespace std;
+
+const uint32_t CHECKPOINT_MAGIC = 0x43545652; // "RVTC"
+const uint32_t CHECKPOINT_VERSION = 2 + BOARD_FORMAT_TAG;	// 2: cache seeds kept apart
+
+#pragma pack(push, 1)
+struct CheckpointHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t nodeCount;		// number of CheckpointNode following the header, root first
+	int8_t grids[GRID_NUM];	// root position key
+	int32_t turn;
+	int32_t state;
+	int32_t evalMode;		// values of different eval modes do not mix
+};
+
+// Nodes are stored breadth first, the children of a node are consecutive and
+// referenced by index, so the file is used in place after mapping.
+struct CheckpointNode
+{
+	GridMask validMask;		// grids not expanded yet
+	uint32_t firstChild;
+	int32_t visit;			// with the cache seed
+	float value;
+	int32_t cacheVisit;		// seeded from the position cache, not searched
+	float cacheValue;
+	float prior;
+	uint8_t move;			// 255: pass
+	uint8_t childCount;
+	uint16_t reserved;
+};
+#pragma pack(pop)
+
+// View of a whole file, read only unless opened for writing.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const string &file);
+	bool OpenWritable(const string &file, uint64_t minSize);	// created or grown with zeros up to minSize
+	void Close();
+
+	const char* GetData() const { return data; }
+	char* GetWritableData() const { return isWritable ? (char*)data : NULL; }
+	uint64_t GetSize() const { return size; }
+
+private:
+	const char *data;
+	uint64_t size;
+	bool isWritable;
+#if defined(_WIN32)
+	void *fileHandle;
+	void *mappingHandle;
+#endif
+};
+
+// replaces target by source, used to publish a finished checkpoint
+bool MoveFileReplace(const string &source, const string &target);
@@ -0,0 +1,558 @@
+#include <cstdio>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "distributed.h"
+#include "analyzer.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#define SHUT_RDWR SD_BOTH
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#define closesocket close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+const uintptr_t	INVALID_SOCKET_HANDLE = ~(uintptr_t)0;
+const int	SOCKET_READ_CHUNK = 4096;
+
+const float	REMOTE_REPORT_INTERVAL = 0.5f;	// seconds between reports of a worker
+const float	REMOTE_POLL_INTERVAL = 0.05f;
+const float	REMOTE_SEARCH_TIME_MAX = 600.f;	// longest search a coordinator may ask for
+const double	REMOTE_VALUE_MAX = 1e6;
+
+// keys of the config RemoteSearch::Start is given by MCTS::Search, a peer must not name files or resources
+const char* const REMOTE_CONFIG_KEYS[] = { "time", "eval", "evalcut", "playout", "cpuct", "cuct", "expand", "fstop", "fsbranch", "trymore", "solve" };
+
+#if defined(_WIN32)
+// winsock needs a startup before the first socket of the process
+struct SocketStartup
+{
+	SocketStartup()
+	{
+		WSADATA data;
+		WSAStartup(MAKEWORD(2, 2), &data);
+	}
+
+	~SocketStartup()
+	{
+		WSACleanup();
+	}
+} socketStartup;
+#endif
+
+Socket::Socket()
+{
+	handle = INVALID_SOCKET_HANDLE;
+}
+
+Socket::~Socket()
+{
+	Close();
+}
+
+bool Socket::Connect(const string &address)
+{
+	Close();
+
+	size_t colon = address.rfind(':');
+	if (colon == string::npos)
+		return false;
+
+	string host = address.substr(0, colon);
+	string port = address.substr(colon + 1);
+
+	addrinfo hints = {}, *result;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &result) != 0)
+		return false;
+
+	for (addrinfo *info = result; info != NULL; info = info->ai_next)
+	{
+		handle = (uintptr_t)socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (handle == INVALID_SOCKET_HANDLE)
+			continue;
+
+		if (connect(handle, info->ai_addr, (int)info->ai_addrlen) == 0)
+			break;
+		Close();
+	}
+	freeaddrinfo(result);
+
+	if (handle == INVALID_SOCKET_HANDLE)
+		return false;
+
+	// reports are small and the coordinator waits for them
+	int noDelay = 1;
+	setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	return true;
+}
+
+bool Socket::Listen(const string &host, int port)
+{
+	Close();
+
+	addrinfo hints = {}, *result;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0)
+		return false;
+
+	for (addrinfo *info = result; info != NULL; info = info->ai_next)
+	{
+		handle = (uintptr_t)socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (handle == INVALID_SOCKET_HANDLE)
+			continue;
+
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		if (bind(handle, info->ai_addr, (int)info->ai_addrlen) == 0 && listen(handle, SOMAXCONN) == 0)
+			break;
+		Close();
+	}
+	freeaddrinfo(result);
+
+	return handle != INVALID_SOCKET_HANDLE;
+}
+
+bool Socket::Accept(Socket &client)
+{
+	client.Close();
+	client.handle = (uintptr_t)accept(handle, NULL, NULL);
+	if (client.handle == INVALID_SOCKET_HANDLE)
+		return false;
+
+	int noDelay = 1;
+	setsockopt(client.handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	return true;
+}
+
+void Socket::Close()
+{
+	if (handle != INVALID_SOCKET_HANDLE)
+		closesocket(handle);
+
+	handle = INVALID_SOCKET_HANDLE;
+	buffer.clear();
+}
+
+void Socket::Shutdown()
+{
+	if (handle != INVALID_SOCKET_HANDLE)
+		shutdown(handle, SHUT_RDWR);
+}
+
+bool Socket::IsOpen() const
+{
+	return handle != INVALID_SOCKET_HANDLE;
+}
+
+bool Socket::SendLine(const string &line)
+{
+	lock_guard<mutex> lock(sendMtx);
+	if (handle == INVALID_SOCKET_HANDLE)
+		return false;
+
+	string data = line + "\n";
+	for (size_t sent = 0; sent < data.size();)
+	{
+		int count = send(handle, data.data() + sent, (int)(data.size() - sent), MSG_NOSIGNAL);
+		if (count <= 0)
+			return false;
+		sent += count;
+	}
+	return true;
+}
+
+bool Socket::ReadLine(string &line)
+{
+	if (handle == INVALID_SOCKET_HANDLE)
+		return false;
+
+	size_t end;
+	while ((end = buffer.find('\n')) == string::npos)
+	{
+		char chunk[SOCKET_READ_CHUNK];
+		int count = recv(handle, chunk, sizeof(chunk), 0);
+		if (count <= 0)
+			return false;
+		buffer.append(chunk, count);
+	}
+
+	line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	return true;
+}
+
+bool Socket::WaitReadable(float seconds)
+{
+	if (buffer.find('\n') != string::npos)
+		return true;
+	if (handle == INVALID_SOCKET_HANDLE)
+		return false;
+
+	fd_set readSet;
+	FD_ZERO(&readSet);
+	FD_SET(handle, &readSet);
+
+	timeval timeout;
+	timeout.tv_sec = (long)seconds;
+	timeout.tv_usec = (long)((seconds - timeout.tv_sec) * 1e6f);
+	return select((int)handle + 1, &readSet, NULL, NULL, &timeout) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+RemoteSearch::RemoteSearch()
+{
+	isActive = false;
+}
+
+RemoteSearch::~RemoteSearch()
+{
+	Stop();
+	Finish(0);
+}
+
+bool RemoteSearch::Start(const string &addresses, GameBase &game, const string &config)
+{
+	Finish(0);
+	{
+		// reports of the last search must not mix into this one
+		lock_guard<mutex> lock(statsMtx);
+		workers.clear();
+		isActive = false;
+	}
+
+	// the position goes as a board, the workers do not need the moves leading to it
+	string board;
+	for (int id = 0; id < GRID_NUM; ++id)
+	{
+		char grid = game.board.GetGrid(id);
+		board += (grid == Board::E_BLACK) ? 'X' : ((grid == Board::E_WHITE) ? 'O' : '-');
+	}
+	string request = "search " + board + " " + ((game.GetSide() == Board::E_BLACK) ? "X" : "O") + " " + config;
+
+	vector<unique_ptr<Worker>> connected;
+	stringstream ss(addresses);
+	string address;
+	while (getline(ss, address, '+'))
+	{
+		if (address.empty())
+			continue;
+
+		unique_ptr<Worker> worker(new Worker());
+		worker->address = address;
+		worker->isAlive = true;
+		worker->isDone = false;
+		if (!worker->socket.Connect(address) || !worker->socket.SendLine(request))
+		{
+			fprintf(stderr, "remote: cannot reach worker %s\n", address.c_str());
+			continue;
+		}
+		connected.push_back(move(worker));
+	}
+
+	lock_guard<mutex> lock(statsMtx);
+	workers = move(connected);
+	isActive = !workers.empty();
+	for (auto &worker : workers)
+		worker->reader = thread(ReaderThread, this, worker.get());
+
+	return isActive;
+}
+
+void RemoteSearch::Stop()
+{
+	lock_guard<mutex> lock(statsMtx);
+	for (auto &worker : workers)
+	{
+		if (worker->isAlive && !worker->isDone)
+			worker->socket.SendLine("stop");
+	}
+}
+
+void RemoteSearch::Finish(float timeout)
+{
+	{
+		unique_lock<mutex> lock(statsMtx);
+		doneCv.wait_for(lock, chrono::duration<float>(timeout), [this]
+		{
+			return all_of(workers.begin(), workers.end(), [](const unique_ptr<Worker> &worker) { return worker->isDone || !worker->isAlive; });
+		});
+	}
+
+	// a worker that does not answer in time is cut off with the report it has sent
+	for (auto &worker : workers)
+	{
+		worker->socket.Shutdown();
+		if (worker->reader.joinable())
+			worker->reader.join();
+	}
+
+	lock_guard<mutex> lock(statsMtx);
+	for (auto &worker : workers)
+		worker->socket.Close();
+}
+
+void RemoteSearch::ReaderThread(RemoteSearch *search, Worker *worker)
+{
+	string line;
+	while (worker->socket.ReadLine(line))
+	{
+		if (line.compare(0, 6, "stats ") == 0)
+		{
+			vector<ShallowStat> stats;
+			if (!ParseStats(line.substr(6), stats))
+				continue;
+
+			lock_guard<mutex> lock(search->statsMtx);
+			worker->stats.swap(stats);
+		}
+		else if (line.compare(0, 4, "done") == 0)
+		{
+			lock_guard<mutex> lock(search->statsMtx);
+			worker->isDone = true;
+			break;
+		}
+	}
+
+	lock_guard<mutex> lock(search->statsMtx);
+	if (!worker->isDone)
+	{
+		worker->isAlive = false;
+		fprintf(stderr, "remote: lost worker %s, %d nodes of its last report are kept\n", worker->address.c_str(), (int)worker->stats.size());
+	}
+	search->doneCv.notify_all();
+}
+
+void RemoteSearch::MergeStats(vector<ShallowStat> &stats)
+{
+	map<vector<int>, size_t> indices;
+	for (size_t i = 0; i < stats.size(); ++i)
+		indices[stats[i].path] = i;
+
+	lock_guard<mutex> lock(statsMtx);
+	for (auto &worker : workers)
+	{
+		for (auto &stat : worker->stats)
+		{
+			auto it = indices.find(stat.path);
+			if (it == indices.end())
+			{
+				indices[stat.path] = stats.size();
+				stats.push_back(stat);
+				continue;
+			}
+
+			ShallowStat &merged = stats[it->second];
+			int visit = merged.visit + stat.visit;
+			merged.winRate = (merged.winRate * merged.visit + stat.winRate * stat.visit) / max(visit, 1);
+			merged.visit = visit;
+		}
+	}
+}
+
+int RemoteSearch::GetAliveCount()
+{
+	lock_guard<mutex> lock(statsMtx);
+	return count_if(workers.begin(), workers.end(), [](const unique_ptr<Worker> &worker) { return worker->isAlive; });
+}
+
+string RemoteSearch::FormatStats(const vector<ShallowStat> &stats)
+{
+	// "visit:winrate:move/move" per node
+	string text;
+	char buffer[32];
+	for (auto &stat : stats)
+	{
+		snprintf(buffer, sizeof(buffer), "%s%d:%.5f:", text.empty() ? "" : " ", stat.visit, stat.winRate);
+		text += buffer;
+		for (size_t i = 0; i < stat.path.size(); ++i)
+			text += (i > 0 ? "/" : "") + to_string(stat.path[i]);
+	}
+	return text;
+}
+
+bool RemoteSearch::ParseStats(const string &text, vector<ShallowStat> &stats)
+{
+	stringstream ss(text);
+	string item;
+	while (ss >> item)
+	{
+		replace(item.begin(), item.end(), ':', ' ');
+		replace(item.begin(), item.end(), '/', ' ');
+
+		stringstream fields(item);
+		ShallowStat stat;
+		int move;
+		if (!(fields >> stat.visit >> stat.winRate))
+			return false;
+		while (fields >> move)
+			stat.path.push_back(move);
+
+		if (stat.path.empty() || !fields.eof())
+			return false;
+		stats.push_back(stat);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+SearchWorker::SearchWorker(const MCTSConfig &config)
+{
+	this->config = config;
+	this->config.remoteWorkers.clear();	// workers do not chain
+}
+
+bool SearchWorker::Run(const string &host, int port)
+{
+	Socket listener;
+	if (!listener.Listen(host, port))
+	{
+		printf("worker: cannot listen on %s:%d\n", host.c_str(), port);
+		return false;
+	}
+
+	printf("worker: listening on %s:%d (%s)\n", host.c_str(), port, config.ToString().c_str());
+	fflush(stdout);
+
+	// every coordinator gets its own session, the searches share the scheduler
+	while (true)
+	{
+		unique_ptr<Socket> socket(new Socket());
+		if (listener.Accept(*socket))
+			thread(SessionThread, this, socket.release()).detach();
+	}
+	return true;
+}
+
+void SearchWorker::SessionThread(SearchWorker *worker, Socket *socket)
+{
+	unique_ptr<Socket> owner(socket);
+	worker->RunSession(*socket);
+}
+
+// only the search keys of the coordinator, numbers in range, on top of the config of the worker
+bool SearchWorker::ParseRemoteConfig(const string &text, MCTSConfig &config)
+{
+	stringstream ss(text);
+	string item;
+	while (getline(ss, item, ','))
+	{
+		if (item.empty())
+			continue;
+
+		size_t pos = item.find('=');
+		if (pos == string::npos)
+			return false;
+
+		string key = item.substr(0, pos), value = item.substr(pos + 1);
+		if (find(begin(REMOTE_CONFIG_KEYS), end(REMOTE_CONFIG_KEYS), key) == end(REMOTE_CONFIG_KEYS))
+			return false;
+
+		char *end;
+		double number = strtod(value.c_str(), &end);
+		if (value.empty() || *end != 0 || !(fabs(number) <= REMOTE_VALUE_MAX))
+			return false;
+		if (key == "time" && !(number > 0 && number <= REMOTE_SEARCH_TIME_MAX))
+			return false;
+
+		config.Set(key, value);
+	}
+	return true;
+}
+
+bool SearchWorker::RunSession(Socket &socket)
+{
+	// "search <board> <side> <config>", then "stop" at any time
+	string line;
+	if (!socket.ReadLine(line) || line.compare(0, 7, "search ") != 0)
+		return false;
+
+	stringstream ss(line.substr(7));
+	string board, side, configText;
+	ss >> board >> side >> configText;
+
+	Game game;
+	string error = "bad config";
+	MCTSConfig searchConfig = config;
+	if (!Analyzer::ParsePosition(board + " " + side, game, error) || !ParseRemoteConfig(configText, searchConfig))
+	{
+		socket.SendLine("error " + error);
+		return false;
+	}
+
+	MCTS ai(0, searchConfig);
+	mutex reportMtx;
+	bool isMoveSent = false;
+	atomic<bool> isFinished(false);
+
+	// the final report goes out before the tree is cleared
+	ai.SetMoveCallback([&](int move)
+	{
+		vector<ShallowStat> stats;
+		ai.GetShallowStats(stats, REMOTE_STAT_DEPTH);
+
+		lock_guard<mutex> lock(reportMtx);
+		socket.SendLine("stats " + RemoteSearch::FormatStats(stats));
+		socket.SendLine("done " + to_string(move));
+		isMoveSent = true;
+	});
+
+	thread searcher([&]
+	{
+		ai.Search(&game);
+		isFinished = true;
+	});
+
+	TimePoint reportTime = chrono::steady_clock::now();
+	while (!isFinished)
+	{
+		if (socket.WaitReadable(REMOTE_POLL_INTERVAL))
+		{
+			// a closed connection is a coordinator that does not wait anymore
+			if (!socket.ReadLine(line))
+			{
+				ai.Stop();
+				break;
+			}
+			if (line == "stop")
+				ai.Stop();
+			continue;
+		}
+
+		if (GetElapsedTime(reportTime) < REMOTE_REPORT_INTERVAL)
+			continue;
+		reportTime = chrono::steady_clock::now();
+
+		vector<ShallowStat> stats;
+		if (!ai.GetShallowStats(stats, REMOTE_STAT_DEPTH))
+			continue;
+
+		lock_guard<mutex> lock(reportMtx);
+		if (!isMoveSent && !socket.SendLine("stats " + RemoteSearch::FormatStats(stats)))
+			ai.Stop();
+	}
+
+	searcher.join();
+	return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
+#include "mcts.h"
+
+const int REMOTE_STAT_DEPTH = 2;	// root moves and the replies to them
+
+// Blocking TCP stream read line by line. Sends are serialized, so reports
+// and replies of different threads never interleave.
+class Socket
+{
+public:
+	Socket();
+	~Socket();
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+
+	bool Connect(const string &address);	// "host:port"
+	bool Listen(const string &host, int port);	// "0.0.0.0" or "::" for every interface
+	bool Accept(Socket &client);
+	void Close();
+	void Shutdown();	// wakes a read blocked on another thread
+	bool IsOpen() const;
+
+	bool SendLine(const string &line);
+	bool ReadLine(string &line);	// false at the end of the stream
+	bool WaitReadable(float seconds);	// a line or the end of the stream is there
+
+private:
+	uintptr_t handle;
+	string buffer;
+	mutex sendMtx;
+};
+
+// Coordinator side of a root parallel search: worker processes ("reversi
+// worker [host:]port") search the same root with their own seed and report the
+// statistics of their shallow nodes while they run. Reports are cumulative,
+// only the last one of each worker is kept, so a worker that dies in the
+// middle of a search still counts with what it sent before.
+class RemoteSearch
+{
+public:
+	RemoteSearch();
+	~RemoteSearch();
+
+	// addresses "host:port+host:port", false if no worker can be reached
+	bool Start(const string &addresses, GameBase &game, const string &config);
+	void Stop();
+	void Finish(float timeout);	// waits for the final reports, then disconnects
+	bool IsActive() { return isActive; }
+
+	// adds the last reports of all workers to stats
+	void MergeStats(vector<ShallowStat> &stats);
+	int GetAliveCount();
+
+	static string FormatStats(const vector<ShallowStat> &stats);
+	static bool ParseStats(const string &text, vector<ShallowStat> &stats);
+
+private:
+	struct Worker
+	{
+		string address;
+		Socket socket;
+		thread reader;
+		vector<ShallowStat> stats;
+		bool isAlive;
+		bool isDone;
+	};
+
+	static void ReaderThread(RemoteSearch *search, Worker *worker);
+
+	vector<unique_ptr<Worker>> workers;
+	atomic<bool> isActive;
+	mutex statsMtx;
+	condition_variable doneCv;
+};
+
+// Serves remote searches on a port, each connection searches on its own MCTS
+// with the workers of the process scheduler. There is no authentication, so
+// it listens on loopback unless another address is given, and a peer may set
+// the search keys of the coordinator only, never files or resources.
+class SearchWorker
+{
+public:
+	SearchWorker(const MCTSConfig &config);
+	bool Run(const string &host, int port);
+
+private:
+	static void SessionThread(SearchWorker *worker, Socket *socket);
+	static bool ParseRemoteConfig(const string &text, MCTSConfig &config);
+	bool RunSession(Socket &socket);
+
+	MCTSConfig config;
+};
@@ -0,0 +1,84 @@
+#include "endgame.h"
+
+atomic<uint64_t> EndgameSolver::table[1 << ENDGAME_TABLE_BITS];
+
+// corners are tried first, they are the winning move more often than not
+static GridMask MakeCornerMask()
+{
+	GridMask mask = GridMask();
+	SetMaskGrid(mask, 0);
+	SetMaskGrid(mask, BOARD_SIZE - 1);
+	SetMaskGrid(mask, GRID_NUM - BOARD_SIZE);
+	SetMaskGrid(mask, GRID_NUM - 1);
+	return mask;
+}
+
+static const GridMask cornerMask = MakeCornerMask();
+
+int EndgameSolver::Solve(const GridMask &own, const GridMask &other)
+{
+	return Search(own, other, GRID_NUM - CountMaskGrids(own | other), false);
+}
+
+int EndgameSolver::SolveGame(GameBase &game)
+{
+	int side = game.GetSide();
+	return ToState(Solve(game.board.GetDiscMask(side), game.board.GetDiscMask(Board::GetOtherSide(side))), side);
+}
+
+int EndgameSolver::ToState(int result, int side)
+{
+	if (result == E_DRAW)
+		return GameBase::E_DRAW;
+
+	return ((result == E_WIN) == (side == Board::E_BLACK)) ? GameBase::E_BLACK_WIN : GameBase::E_WHITE_WIN;
+}
+
+int EndgameSolver::Search(const GridMask &own, const GridMask &other, int empties, bool isPassed)
+{
+	GridMask moves = BitBoard<BOARD_SIZE>::CalcMoves(own, other);
+	if (IsMaskEmpty(moves))
+	{
+		if (!isPassed)
+			return -Search(other, own, empties, true);
+
+		// neither side can move, more discs win
+		int diff = CountMaskGrids(own) - CountMaskGrids(other);
+		return (diff > 0) ? E_WIN : ((diff < 0) ? E_LOSS : E_DRAW);
+	}
+
+	// the low 2 bits of an entry hold the result + 2, 0: empty
+	uint64_t key = 0;
+	atomic<uint64_t> *entry = NULL;
+	if (empties >= ENDGAME_HASH_MIN_EMPTIES)
+	{
+		key = HashMask(other, HashMask(own, 0)) & ~3ULL;
+		entry = &table[key >> (64 - ENDGAME_TABLE_BITS)];
+		uint64_t data = entry->load(memory_order_relaxed);
+		if ((data & ~3ULL) == key && (data & 3) != 0)
+			return (int)(data & 3) - 2;
+
+		// more than half of the board stable decides the game
+		if (CountMaskGrids(BitBoard<BOARD_SIZE>::CalcStable(own, other)) > GRID_NUM / 2)
+			return E_WIN;
+		if (CountMaskGrids(BitBoard<BOARD_SIZE>::CalcStable(other, own)) > GRID_NUM / 2)
+			return E_LOSS;
+	}
+
+	int best = E_LOSS - 1;
+	GridMask corners = moves & cornerMask;
+	GridMask rest = moves & ~cornerMask;
+	while (best < E_WIN && !(IsMaskEmpty(corners) && IsMaskEmpty(rest)))
+	{
+		int id = !IsMaskEmpty(corners) ? PopMaskGrid(corners) : PopMaskGrid(rest);
+		GridMask flips = BitBoard<BOARD_SIZE>::CalcFlips(own, other, id);
+		SetMaskGrid(flips, id);
+
+		int value = -Search(other & ~flips, own | flips, empties - 1, false);
+		best = max(best, value);
+	}
+
+	if (entry != NULL)
+		entry->store(key | (uint64_t)(best + 2), memory_order_relaxed);
+	return best;
+}
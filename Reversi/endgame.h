@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include "game.h"
+
+const int ENDGAME_TABLE_BITS = 20;			// 8 MB of results
+const int ENDGAME_HASH_MIN_EMPTIES = 5;		// smaller positions are searched again, cheaper than a probe
+
+// Exact result of positions with few empties by negamax on disc masks, used
+// for the last plies of the rollouts. Only win, draw or loss is searched, so
+// the search stops at the first winning move and every result is exact.
+// Results are kept in one table of the process, an entry is a single word of
+// key and result, threads share it without a lock. An overwritten entry is a
+// miss, a key can only come back with its own result.
+class EndgameSolver
+{
+public:
+	enum Result
+	{
+		E_LOSS = -1,
+		E_DRAW,
+		E_WIN,
+	};
+
+	static int Solve(const GridMask &own, const GridMask &other);	// Result of the side of own, to move
+	static int SolveGame(GameBase &game);	// GameBase::State at the end of perfect play
+	static int ToState(int result, int side);	// GameBase::State of the Result of side
+
+private:
+	static int Search(const GridMask &own, const GridMask &other, int empties, bool isPassed);
+
+	static atomic<uint64_t> table[1 << ENDGAME_TABLE_BITS];
+};
@@ -0,0 +1,183 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include "eval.h"
+
+const float EVAL_WIN_RATE_SCALE = 8.f; // disc difference of a 73% win rate
+
+// disc value of each grid of 8x8, used until trained weights are loaded
+const float DEFAULT_GRID_VALUE[8 * 8] = {
+	20, -3,  2,  1,  1,  2, -3, 20,
+	-3, -7, -1, -1, -1, -1, -7, -3,
+	 2, -1,  1,  0,  0,  1, -1,  2,
+	 1, -1,  0,  0,  0,  0, -1,  1,
+	 1, -1,  0,  0,  0,  0, -1,  1,
+	 2, -1,  1,  0,  0,  1, -1,  2,
+	-3, -7, -1, -1, -1, -1, -7, -3,
+	20, -3,  2,  1,  1,  2, -3, 20,
+};
+
+// other sizes take the value of the 8x8 grid at the same distance to the edges
+float GetDefaultGridValue(int id)
+{
+	int row, col;
+	Board::Id2Coord(id, row, col);
+
+	auto mapCoord = [](int x) { return (x < BOARD_SIZE / 2) ? min(x, 3) : 7 - min(BOARD_SIZE - 1 - x, 3); };
+	return DEFAULT_GRID_VALUE[mapCoord(row) * 8 + mapCoord(col)];
+}
+
+bool Evaluator::IsReady = false;
+int Evaluator::weightNum = 0;
+array<int, E_PATTERN_TYPE_MAX> Evaluator::typeOffset;
+array<vector<float>, EVAL_STAGE_NUM> Evaluator::weights;
+
+void Evaluator::Init()
+{
+	if (Evaluator::IsReady)
+		return;
+
+	if (!Pattern::IsReady)
+		Pattern::Init();
+
+	weightNum = 0;
+	for (int type = 0; type < E_PATTERN_TYPE_MAX; ++type)
+	{
+		typeOffset[type] = weightNum;
+		weightNum += Pattern::GetTypeSize(type);
+	}
+
+	InitDefaultWeights();
+	Evaluator::IsReady = true;
+}
+
+void Evaluator::InitDefaultWeights()
+{
+	// spread the grid values over the patterns covering each grid
+	vector<float> defaultWeights(weightNum, 0.f);
+
+	int instance = 0;
+	for (int type = 0; type < E_PATTERN_TYPE_MAX; ++type)
+	{
+		int gridCount = Pattern::typeGridCount[type];
+		for (int code = 0; code < Pattern::GetTypeSize(type); ++code)
+		{
+			float weight = 0;
+			for (int i = 0; i < gridCount; ++i)
+			{
+				int id = Pattern::instanceGrids[instance][i];
+				int chess = (code / Pattern::pow3[i]) % 3;
+				float value = GetDefaultGridValue(id) / Pattern::gridRefCount[id];
+
+				if (chess == Board::E_BLACK)
+					weight += value;
+				else if (chess == Board::E_WHITE)
+					weight -= value;
+			}
+			defaultWeights[typeOffset[type] + code] = weight;
+		}
+		instance += Pattern::typeInstanceCount[type];
+	}
+
+	for (int stage = 0; stage < EVAL_STAGE_NUM; ++stage)
+		weights[stage] = defaultWeights;
+}
+
+// weight file: header, then int16 weights of every stage, weight = value * scale
+struct EvalWeightHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t stageNum;
+	uint32_t weightNum;
+	float scale;
+};
+
+bool Evaluator::LoadWeights(const string &file)
+{
+	Init();
+
+	FILE *fp;
+	if (fopen_s(&fp, file.c_str(), "rb") != 0)
+		return false;
+
+	EvalWeightHeader header;
+	bool isValid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == EVAL_WEIGHT_MAGIC && header.version == EVAL_WEIGHT_VERSION
+		&& header.stageNum == EVAL_STAGE_NUM && header.weightNum == (uint32_t)weightNum;
+
+	vector<int16_t> values(weightNum);
+	array<vector<float>, EVAL_STAGE_NUM> loaded;
+	for (int stage = 0; isValid && stage < EVAL_STAGE_NUM; ++stage)
+	{
+		isValid = fread(values.data(), sizeof(int16_t), weightNum, fp) == (size_t)weightNum;
+
+		loaded[stage].resize(weightNum);
+		for (int i = 0; i < weightNum; ++i)
+			loaded[stage][i] = values[i] * header.scale;
+	}
+	fclose(fp);
+
+	if (!isValid)
+		return false;
+
+	weights = move(loaded);
+	return true;
+}
+
+bool Evaluator::SaveWeights(const string &file)
+{
+	Init();
+
+	float maxWeight = 1e-6f;
+	for (auto &stageWeights : weights)
+	{
+		for (auto w : stageWeights)
+			maxWeight = max(maxWeight, fabsf(w));
+	}
+
+	FILE *fp;
+	if (fopen_s(&fp, file.c_str(), "wb") != 0)
+		return false;
+
+	EvalWeightHeader header;
+	header.magic = EVAL_WEIGHT_MAGIC;
+	header.version = EVAL_WEIGHT_VERSION;
+	header.stageNum = EVAL_STAGE_NUM;
+	header.weightNum = weightNum;
+	header.scale = maxWeight / 32767;
+	bool isValid = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+	vector<int16_t> values(weightNum);
+	for (int stage = 0; isValid && stage < EVAL_STAGE_NUM; ++stage)
+	{
+		for (int i = 0; i < weightNum; ++i)
+			values[i] = (int16_t)lroundf(weights[stage][i] / header.scale);
+
+		isValid = fwrite(values.data(), sizeof(int16_t), weightNum, fp) == (size_t)weightNum;
+	}
+	fclose(fp);
+
+	return isValid;
+}
+
+int Evaluator::GetStage(const Board &board)
+{
+	int stage = (board.blackCount + board.whiteCount - 4) * EVAL_STAGE_NUM / (GRID_NUM - 3);
+	return (stage < 0) ? 0 : ((stage >= EVAL_STAGE_NUM) ? EVAL_STAGE_NUM - 1 : stage);
+}
+
+float Evaluator::Evaluate(const Board &board)
+{
+	const float *w = weights[GetStage(board)].data();
+
+	float score = 0;
+	for (int i = 0; i < PATTERN_INSTANCE_NUM; ++i)
+		score += w[typeOffset[Pattern::instanceType[i]] + board.GetPatternCode(i)];
+
+	return score;
+}
+
+float Evaluator::ToWinRate(float score)
+{
+	return 1.f / (1.f + expf(-score / EVAL_WIN_RATE_SCALE));
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "game.h"
+
+const int EVAL_STAGE_NUM = 12;
+const uint32_t EVAL_WEIGHT_MAGIC = 0x57455652; // "RVEW"
+const uint32_t EVAL_WEIGHT_VERSION = 1 + BOARD_FORMAT_TAG;
+const char* const EVAL_WEIGHT_FILE = "eval.bin";
+
+// Static evaluation by pattern weight tables, one set of tables per game stage.
+// Scores are expected final disc differences from black's view.
+class Evaluator
+{
+public:
+	static void Init();
+	static bool LoadWeights(const string &file);
+	static bool SaveWeights(const string &file);
+
+	static float Evaluate(const Board &board);
+	static float ToWinRate(float score);
+	static int GetStage(const Board &board);
+
+	static int GetWeightNum() { return weightNum; }
+	static int GetTypeOffset(int type) { return typeOffset[type]; }
+	static float* GetWeights(int stage) { return weights[stage].data(); }
+
+private:
+	static void InitDefaultWeights();
+
+	static bool IsReady;
+	static int weightNum;
+	static array<int, E_PATTERN_TYPE_MAX> typeOffset;
+	static array<vector<float>, EVAL_STAGE_NUM> weights;
+};
@@ -1,5 +1,8 @@
 ﻿#include "game.h"
+#include "history.h"
 #include <cstdlib>
+#include <cmath>
+#include <cctype>
 
 #define max(a, b) ((a > b) ? a : b)
 
@@ -11,13 +14,18 @@ Board::Board()
 	if (!Board::IsGridPriorityDictReady)
 		Board::InitGridPriorityDict();
 
+	if (!Pattern::IsReady)
+		Pattern::Init();
+
 	Clear();
 }
 
 void Board::Clear()
 {
 	grids.fill(E_EMPTY);
+	discMasks.fill(GridMask());
 	gridCheckStatus.fill(E_OTHER_TYPE);
+	patternCodes.fill(0);
 
 	blackCount = whiteCount = 0;
 }
@@ -28,17 +36,18 @@ void Board::InitGridPriorityDict()
 	{
 		Board::gridPriorityDict[i].fill(E_PRIORITY_MIDDLE);
 
-		int winningGrids[4] = { Board::Coord2Id(0, 0), Board::Coord2Id(7, 0),
-								Board::Coord2Id(0, 7), Board::Coord2Id(7, 7)};
+		const int last = BOARD_SIZE - 1;
+		int winningGrids[4] = { Board::Coord2Id(0, 0), Board::Coord2Id(last, 0),
+								Board::Coord2Id(0, last), Board::Coord2Id(last, last)};
 		for (int j = 0; j < 4; ++j)
 		{
 			Board::gridPriorityDict[i][winningGrids[j]] = E_PRIORITY_HIGH;
 		}
 
 		int losingGrids[4][3] = {{Board::Coord2Id(0, 1), Board::Coord2Id(1, 0), Board::Coord2Id(1, 1) },
-								{ Board::Coord2Id(0, 6), Board::Coord2Id(1, 7), Board::Coord2Id(1, 6) },
-								{ Board::Coord2Id(7, 1), Board::Coord2Id(6, 0), Board::Coord2Id(6, 1) },
-								{ Board::Coord2Id(7, 6), Board::Coord2Id(6, 7), Board::Coord2Id(6, 6)}};
+								{ Board::Coord2Id(0, last - 1), Board::Coord2Id(1, last), Board::Coord2Id(1, last - 1) },
+								{ Board::Coord2Id(last, 1), Board::Coord2Id(last - 1, 0), Board::Coord2Id(last - 1, 1) },
+								{ Board::Coord2Id(last, last - 1), Board::Coord2Id(last - 1, last), Board::Coord2Id(last - 1, last - 1)}};
 		for (int j = 0; j < 4; ++j)
 		{
 			bool isCornerFill = i & (1 << j);
@@ -108,10 +117,13 @@ void Board::PrintSplitLine(int i)
 
 void Board::Print(int lastMove)
 {
-	cout << "    Ａ  Ｂ  Ｃ  Ｄ  Ｅ  Ｆ  Ｇ  Ｈ";
+	string letters[] = { "Ａ", "Ｂ", "Ｃ", "Ｄ", "Ｅ", "Ｆ", "Ｇ", "Ｈ", "Ｉ", "Ｊ" };
+	cout << "  ";
+	for (int i = 0; i < BOARD_SIZE; ++i)
+		cout << "  " << letters[i];
 	cout << endl;
 
-	string digits[] = { "１", "２", "３", "４", "５", "６", "７", "８" };
+	string digits[] = { "１", "２", "３", "４", "５", "６", "７", "８", "９", "10" };
 
 	PrintSplitLine(0);
 	for (int i = 0; i < BOARD_SIZE; ++i)
@@ -169,15 +181,22 @@ void Board::SetGrid(int id, char value, bool needReverse)
 		++whiteCount;
 
 	grids[id] = value;
+	ClearMaskGrid(discMasks[oldValue], id);
+	SetMaskGrid(discMasks[value], id);
+
+	// keep pattern codes up to date, flips go through here as well
+	int delta = value - oldValue;
+	for (int i = 0; i < Pattern::gridRefCount[id]; ++i)
+		patternCodes[Pattern::gridRefInstance[id][i]] += delta * Pattern::gridRefPow3[id][i];
+
 	MarkNearGrids(id);
 	UpdatePriorityDictKey();
 
 	if (needReverse)
 	{
-		for (int i = 0; i < 8; ++i)
-		{
-			TryReverseInDirection(value, id, (ChessDirection)i, true);
-		}
+		GridMask flips = BitBoard<BOARD_SIZE>::CalcFlips(discMasks[value], discMasks[GetOtherSide(value)], id);
+		while (!IsMaskEmpty(flips))
+			SetGrid(PopMaskGrid(flips), value, false);
 	}
 }
 
@@ -199,6 +218,85 @@ void Board::GetValidGridsByPriority(GridPriority priority, array<uint8_t, GRID_N
 	}
 }
 
+void Board::GetAllValidGrids(array<uint8_t, GRID_NUM> &validGrids, int &validGridCount)
+{
+	validGridCount = 0;
+	for (int i = 0; i < GRID_NUM; ++i)
+	{
+		if (gridCheckStatus[i] == E_VALID_TYPE)
+			validGrids[validGridCount++] = i;
+	}
+}
+
+// cheap local features of a legal move for the playout policy
+void Board::CalcMoveFeatures(int side, int id, int &flips, int &frontierFlips, int &emptyNeighbors, bool &isStable)
+{
+	int otherSide = Board::GetOtherSide(side);
+	int row, col;
+	Board::Id2Coord(id, row, col);
+
+	flips = frontierFlips = emptyNeighbors = 0;
+	for (int dy = -1; dy <= 1; ++dy)
+	{
+		for (int dx = -1; dx <= 1; ++dx)
+		{
+			if (dx == 0 && dy == 0)
+				continue;
+
+			if (GetGrid(row + dy, col + dx) == E_EMPTY)
+				++emptyNeighbors;
+
+			int count = 0;
+			int row1 = row + dy, col1 = col + dx;
+			while (GetGrid(row1, col1) == otherSide)
+			{
+				++count;
+				row1 += dy; col1 += dx;
+			}
+
+			if (count == 0 || GetGrid(row1, col1) != side)
+				continue;
+
+			flips += count;
+
+			// flipped discs next to an empty grid give the opponent new moves
+			for (int i = 1; i <= count; ++i)
+			{
+				int row2 = row + dy * i, col2 = col + dx * i;
+				bool isFrontier = false;
+				for (int ny = -1; ny <= 1 && !isFrontier; ++ny)
+				{
+					for (int nx = -1; nx <= 1 && !isFrontier; ++nx)
+						isFrontier = GetGrid(row2 + ny, col2 + nx) == E_EMPTY;
+				}
+				frontierFlips += isFrontier;
+			}
+		}
+	}
+
+	// corners, and edge grids connected to an own corner by own discs
+	isStable = false;
+	bool isRowEdge = (row == 0 || row == BOARD_SIZE - 1);
+	bool isColEdge = (col == 0 || col == BOARD_SIZE - 1);
+	if (isRowEdge && isColEdge)
+	{
+		isStable = true;
+	}
+	else if (isRowEdge || isColEdge)
+	{
+		int dx = isRowEdge ? 1 : 0, dy = isRowEdge ? 0 : 1;
+		for (int dir = -1; dir <= 1 && !isStable; dir += 2)
+		{
+			int row1 = row + dy * dir, col1 = col + dx * dir;
+			while (GetGrid(row1, col1) == side)
+			{
+				row1 += dy * dir; col1 += dx * dir;
+			}
+			isStable = GetGrid(row1, col1) == E_INVALID;
+		}
+	}
+}
+
 bool Board::IsKeyGridsValid()
 {
 	int keyGrids[4] = { 0, BOARD_SIZE - 1, BOARD_SIZE * (BOARD_SIZE - 1), BOARD_SIZE * BOARD_SIZE - 1 };
@@ -238,120 +336,27 @@ void Board::CheckGridStatus(int side)
 {
 	hasPriority.fill(false);
 
+	GridMask moves = BitBoard<BOARD_SIZE>::CalcMoves(discMasks[side], discMasks[GetOtherSide(side)]);
 	for (int i = 0; i < GRID_NUM; ++i)
 	{
 		if (gridCheckStatus[i] != E_OTHER_TYPE)
 		{
 			gridCheckStatus[i] = E_MAYBE_TYPE;
-			for (int k = 0; k < 8; ++k)
+			if (TestMaskGrid(moves, i))
 			{
-				if (TryReverseInDirection(side, i, (ChessDirection)k, false))
-				{
-					gridCheckStatus[i] = E_VALID_TYPE;
-					hasPriority[Board::gridPriorityDict[priorityDictKey][i]] = true;
-					break;
-				}
+				gridCheckStatus[i] = E_VALID_TYPE;
+				hasPriority[Board::gridPriorityDict[priorityDictKey][i]] = true;
 			}
 		}
 	}
 }
 
-__declspec(noinline)
-bool Board::TryReverseInDirection(int side, int id, ChessDirection dir, bool isChange)
-{
-	int row = 0, col = 0;
-	Board::Id2Coord(id, row, col);
-
-	int dx = 0, dy = 0;
-	switch (dir)
-	{
-	case Board::E_L_R:
-		dx = 1;
-		break;
-	case Board::E_R_L:
-		dx = -1;
-		break;
-	case Board::E_T_B:
-		dy = 1;
-		break;
-	case Board::E_B_T:
-		dy = -1;
-		break;
-	case Board::E_TL_BR:
-		dx = dy = 1;
-		break;
-	case Board::E_BR_TL:
-		dx = dy = -1;
-		break;
-	case Board::E_TR_BL:
-		dx = 1;
-		dy = -1;
-		break;
-	case Board::E_BL_TR:
-		dx = -1;
-		dy = 1;
-		break;
-	}
-
-	return TryReverseInDirectionReal(side, row, col, dx, dy, isChange);
-}
-
-__declspec(noinline)
-bool Board::TryReverseInDirectionReal(int side, int row, int col, int dx, int dy, bool isChange)
-{
-	bool valid = false;
-	char otherSide = Board::GetOtherSide(side);
-
-	int row1 = row, col1 = col;
-	for (int i = 1; i < BOARD_SIZE; ++i)
-	{
-		row1 += dy; col1 += dx;
-		char chess = GetGrid(row1, col1);
-
-		if (!valid) // try to find an opposite chess
-		{
-			if (chess == otherSide)
-			{
-				valid = true;
-			}
-			else
-			{
-				return false;
-			}
-		}
-		else // try to find a same chess
-		{
-			if (chess == side)
-			{
-				if (isChange)
-				{
-					int id1 = Board::Coord2Id(row, col);
-					for (int j = 1; j < i; ++j) // do reverse
-					{
-						id1 += dy * BOARD_SIZE + dx;
-						SetGrid(id1, side, false);
-					}
-				}
-				return true;
-			}
-			else if (chess == otherSide)
-			{
-				// do nothing
-			}
-			else
-			{
-				return false;
-			}
-		}
-	}
-	return false;
-}
-
 void Board::UpdatePriorityDictKey()
 {
 	priorityDictKey = 0;
 
-	int cornerGrids[4] = { Board::Coord2Id(0, 0), Board::Coord2Id(7, 0), Board::Coord2Id(0, 7), Board::Coord2Id(7, 7) };
+	const int last = BOARD_SIZE - 1;
+	int cornerGrids[4] = { Board::Coord2Id(0, 0), Board::Coord2Id(last, 0), Board::Coord2Id(0, last), Board::Coord2Id(last, last) };
 	for (int i = 0; i < 4; ++i)
 	{
 		if (grids[cornerGrids[i]] != E_EMPTY)
@@ -397,12 +402,64 @@ void GameBase::Init()
 	lastBlackCount = 0;
 	lastWhiteCount = 0;
 
-	board.SetGrid(Game::Str2Id("D4"), Board::E_WHITE);
-	board.SetGrid(Game::Str2Id("D5"), Board::E_BLACK);
-	board.SetGrid(Game::Str2Id("E4"), Board::E_BLACK);
-	board.SetGrid(Game::Str2Id("E5"), Board::E_WHITE);
+	// D4 E5 white, D5 E4 black on 8x8
+	const int center = BOARD_SIZE / 2 - 1;
+	board.SetGrid(Board::Coord2Id(center, center), Board::E_WHITE);
+	board.SetGrid(Board::Coord2Id(center + 1, center), Board::E_BLACK);
+	board.SetGrid(Board::Coord2Id(center, center + 1), Board::E_BLACK);
+	board.SetGrid(Board::Coord2Id(center + 1, center + 1), Board::E_WHITE);
+
+	UpdateValidGrids();
+}
+
+// any position with the side to move, turn follows the disc count as if no one had passed
+bool GameBase::SetPosition(const array<char, GRID_NUM> &grids, int side)
+{
+	if (side != Board::E_BLACK && side != Board::E_WHITE)
+		return false;
+
+	for (auto grid : grids)
+	{
+		if (grid != Board::E_EMPTY && grid != Board::E_BLACK && grid != Board::E_WHITE)
+			return false;
+	}
+
+	board.Clear();
+	for (int id = 0; id < GRID_NUM; ++id)
+	{
+		if (grids[id] != Board::E_EMPTY)
+			board.SetGrid(id, grids[id], false);
+	}
+
+	turn = max(board.blackCount + board.whiteCount - 3, 1);
+	if (GetSide() != side)
+		++turn;
+
+	lastMove = -1;
+	lastBlackCount = board.blackCount;
+	lastWhiteCount = board.whiteCount;
+	state = E_NORMAL;
 
+	// without a move the other side decides between a pass and the end of the game
+	++turn;
+	UpdateValidGrids();
+	int otherCount = validGridCount;
+	--turn;
 	UpdateValidGrids();
+
+	bool isFull = board.blackCount + board.whiteCount == GRID_NUM;
+	if (board.blackCount == 0 || board.whiteCount == 0 || isFull || (validGridCount == 0 && otherCount == 0))
+	{
+		if (board.blackCount == board.whiteCount)
+			state = E_DRAW;
+		else
+			state = (board.blackCount > board.whiteCount) ? E_BLACK_WIN : E_WHITE_WIN;
+	}
+	else if (validGridCount == 0)
+	{
+		state = E_PASS;
+	}
+	return true;
 }
 
 __declspec(noinline)
@@ -458,12 +515,38 @@ bool GameBase::PutChess(int id)
 	return true;
 }
 
+// play a move of a game record, passes may be left out of the record
+bool GameBase::PutRecordMove(int id)
+{
+	if (id < 0 || id >= GRID_NUM) // explicit pass
+		return (state == E_PASS) ? PutChess(-1) : false;
+
+	if (state == E_PASS)
+		PutChess(-1);
+
+	if (state != E_NORMAL || board.GetGridType(id) != Board::E_VALID_TYPE)
+		return false;
+
+	return PutChess(id);
+}
+
 __declspec(noinline)
-bool GameBase::PutRandomChess()
+bool GameBase::PutRandomChess(const PlayoutHistory *history)
 {
 	if (state == E_PASS)
 		return PutChess(-1);
 
+	// the last good reply to the previous move, if it is among the top priority grids
+	if (history != NULL)
+	{
+		int reply = history->GetReply(GetSide(), lastMove);
+		for (int i = 0; i < validGridCount && reply >= 0; ++i)
+		{
+			if (validGrids[i] == reply)
+				return PutChess(reply);
+		}
+	}
+
 	int id = rand() % validGridCount;
 	swap(validGrids[id], validGrids[validGridCount - 1]);
 	int gridId = validGrids[validGridCount - 1];
@@ -471,43 +554,82 @@ bool GameBase::PutRandomChess()
 	return PutChess(gridId);
 }
 
-void GameBase::UpdateValidGrids()
+// heavy playout: sample a move from the softmax of its feature score, the features are local
+// counts around the grid, the pattern weights belong to the evaluator above this layer
+__declspec(noinline)
+bool GameBase::PutPolicyChess(const PlayoutHistory *history)
 {
-	board.CheckGridStatus(GetSide());
+	if (state == E_PASS)
+		return PutChess(-1);
 
-	validGridCount = 0;
-	for (int i = Board::E_PRIORITY_HIGH; i < Board::E_PRIORITY_MAX; ++i)
+	array<uint8_t, GRID_NUM> moves;
+	int moveCount = 0;
+	board.GetAllValidGrids(moves, moveCount);
+
+	if (moveCount == 1)
+		return PutChess(moves[0]);
+
+	// features are gathered per move, then all moves are scored in one pass
+	array<float, GRID_NUM> priorityScore, flips, frontierFlips, emptyNeighbors, stable, score;
+	int side = GetSide();
+	for (int i = 0; i < moveCount; ++i)
 	{
-		if (board.hasPriority[i])
+		int flipCount, frontierCount, emptyCount;
+		bool isStable;
+		board.CalcMoveFeatures(side, moves[i], flipCount, frontierCount, emptyCount, isStable);
+
+		priorityScore[i] = POLICY_PRIORITY_WEIGHT[board.GetGridPriority(moves[i])];
+		flips[i] = flipCount;
+		frontierFlips[i] = frontierCount;
+		emptyNeighbors[i] = emptyCount;
+		stable[i] = isStable ? 1.f : 0.f;
+	}
+
+	float maxScore = -1e9f;
+	for (int i = 0; i < moveCount; ++i)
+	{
+		score[i] = priorityScore[i] + POLICY_FLIP_WEIGHT * flips[i] + POLICY_FRONTIER_FLIP_WEIGHT * frontierFlips[i]
+			+ POLICY_EMPTY_NEIGHBOR_WEIGHT * emptyNeighbors[i] + POLICY_STABLE_WEIGHT * stable[i];
+		if (history != NULL)
+			score[i] += history->CalcBonus(side, lastMove, moves[i]);
+		maxScore = max(maxScore, score[i]);
+	}
+
+	float sum = 0;
+	for (int i = 0; i < moveCount; ++i)
+	{
+		score[i] = expf(score[i] - maxScore);
+		sum += score[i];
+	}
+
+	float r = rand() * sum / (RAND_MAX + 1.f);
+	int pick = moveCount - 1;
+	for (int i = 0; i < moveCount - 1; ++i)
+	{
+		r -= score[i];
+		if (r < 0)
 		{
-			board.GetValidGridsByPriority((Board::GridPriority)i, validGrids, validGridCount);
+			pick = i;
 			break;
 		}
 	}
+
+	return PutChess(moves[pick]);
 }
 
-bool GameBase::UpdateValidGridsExtra()
+void GameBase::UpdateValidGrids()
 {
-	if (turn < GRID_NUM / 2)
-		return false;
+	board.CheckGridStatus(GetSide());
 
-	bool isExtra = false;
+	validGridCount = 0;
 	for (int i = Board::E_PRIORITY_HIGH; i < Board::E_PRIORITY_MAX; ++i)
 	{
 		if (board.hasPriority[i])
 		{
-			if (!isExtra)
-			{
-				isExtra = true;
-			}
-			else
-			{
-				board.GetValidGridsByPriority((Board::GridPriority)i, validGrids, validGridCount);
-				break;
-			}
+			board.GetValidGridsByPriority((Board::GridPriority)i, validGrids, validGridCount);
+			break;
 		}
 	}
-	return false;
 }
 
 int GameBase::GetSide()
@@ -543,6 +665,15 @@ bool GameBase::IsOverwhelming()
 	return false;
 }
 
+int GameBase::CalcStableWinner()
+{
+	// more than half of the board stable needs that many discs first, which is rare before the end
+	int side = (board.blackCount > GRID_NUM / 2) ? Board::E_BLACK : ((board.whiteCount > GRID_NUM / 2) ? Board::E_WHITE : Board::E_EMPTY);
+	if (side != Board::E_EMPTY && board.CountStable(side) > GRID_NUM / 2)
+		return side;
+	return Board::E_EMPTY;
+}
+
 int GameBase::CalcBetterSide()
 {
 	int blackCount = lastBlackCount + board.blackCount;
@@ -557,6 +688,12 @@ int GameBase::CalcBetterSide()
 	return E_DRAW;
 }
 
+uint64_t GameBase::CalcPositionKey()
+{
+	int side = GetSide();
+	return HashMask(board.GetDiscMask(Board::GetOtherSide(side)), HashMask(board.GetDiscMask(side), side));
+}
+
 ///////////////////////////////////////////////////////////////////
 
 bool Game::PutChess(int Id)
@@ -569,6 +706,13 @@ bool Game::PutChess(int Id)
 	return false;
 }
 
+bool Game::SetPosition(const array<char, GRID_NUM> &grids, int side)
+{
+	// the record only replays from the start position
+	record.clear();
+	return GameBase::SetPosition(grids, side);
+}
+
 void Game::Regret(int step)
 {
 	while (!record.empty() && --step >= 0)
@@ -601,8 +745,12 @@ void Game::Print()
 
 int Game::Str2Id(const string &str)
 {
+	// "A1" to "H8", rows have two digits from 10x10 on
+	if (str.size() < 2 || str.size() > 3 || !isdigit((unsigned char)str[1]) || (str.size() == 3 && !isdigit((unsigned char)str[2])))
+		return -1;
+
 	int col = str[0] - 'A';
-	int row = str[1] - '1';
+	int row = stoi(str.substr(1)) - 1;
 	if (!Board::IsValidCoord(row, col))
 		return -1;
 
@@ -618,6 +766,6 @@ string Game::Id2Str(int id)
 	int row, col;
 	Board::Id2Coord(id, row, col);
 	string result(1, col + 'A');
-	result += row + '1';
+	result += to_string(row + 1);
 	return result;
 }
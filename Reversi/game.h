@@ -4,16 +4,318 @@
 #include <vector>
 #include <array>
 #include <list>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #pragma warning (disable:4244)
 #pragma warning (disable:4018)
 
 using namespace std;
 
-const int BOARD_SIZE = 8;
+// the board size is fixed by the build, -DREVERSI_BOARD_SIZE=6 or 10 for the other variants
+#ifndef REVERSI_BOARD_SIZE
+#define REVERSI_BOARD_SIZE 8
+#endif
+
+const int BOARD_SIZE = REVERSI_BOARD_SIZE;
 const int GRID_NUM = BOARD_SIZE * BOARD_SIZE;
 const int GRID_PRIORITY_DICT_NUM = 16;
 
+static_assert(BOARD_SIZE == 6 || BOARD_SIZE == 8 || BOARD_SIZE == 10, "supported board sizes are 6, 8 and 10");
+
+// added to the versions of binary files so that builds of other sizes reject them, 8x8 files keep theirs
+const uint32_t BOARD_FORMAT_TAG = (BOARD_SIZE == 8) ? 0 : BOARD_SIZE << 16;
+
+// index of the lowest set bit, mask must not be 0
+inline int BitScanForward64(uint64_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return index;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// Grid masks of boards beyond 64 grids.
+struct GridMask128
+{
+	uint64_t low, high;
+
+	GridMask128 operator&(const GridMask128 &m) const { return { low & m.low, high & m.high }; }
+	GridMask128 operator|(const GridMask128 &m) const { return { low | m.low, high | m.high }; }
+	GridMask128 operator~() const { return { ~low, ~high }; }
+	GridMask128& operator|=(const GridMask128 &m) { low |= m.low; high |= m.high; return *this; }
+	GridMask128& operator&=(const GridMask128 &m) { low &= m.low; high &= m.high; return *this; }
+};
+
+// One bit per grid: a single word up to 8x8, two words for 10x10.
+template<int SIZE> struct GridMaskType { typedef uint64_t Type; };
+template<> struct GridMaskType<10> { typedef GridMask128 Type; };
+typedef GridMaskType<BOARD_SIZE>::Type GridMask;
+
+inline bool IsMaskEmpty(uint64_t mask) { return mask == 0; }
+inline bool IsMaskEmpty(const GridMask128 &mask) { return (mask.low | mask.high) == 0; }
+
+inline void SetMaskGrid(uint64_t &mask, int id) { mask |= 1ULL << id; }
+inline void SetMaskGrid(GridMask128 &mask, int id) { (id < 64 ? mask.low : mask.high) |= 1ULL << (id & 63); }
+
+inline void ClearMaskGrid(uint64_t &mask, int id) { mask &= ~(1ULL << id); }
+inline void ClearMaskGrid(GridMask128 &mask, int id) { (id < 64 ? mask.low : mask.high) &= ~(1ULL << (id & 63)); }
+
+inline int CountMaskGrids(uint64_t mask)
+{
+#if defined(_MSC_VER)
+	return (int)__popcnt64(mask);
+#else
+	return __builtin_popcountll(mask);
+#endif
+}
+
+inline int CountMaskGrids(const GridMask128 &mask) { return CountMaskGrids(mask.low) + CountMaskGrids(mask.high); }
+
+inline bool TestMaskGrid(uint64_t mask, int id) { return (mask >> id) & 1; }
+inline bool TestMaskGrid(const GridMask128 &mask, int id) { return ((id < 64 ? mask.low : mask.high) >> (id & 63)) & 1; }
+
+// removes the lowest grid of a non-empty mask and returns it
+inline int PopMaskGrid(uint64_t &mask)
+{
+	int id = BitScanForward64(mask);
+	mask &= mask - 1;
+	return id;
+}
+
+inline int PopMaskGrid(GridMask128 &mask)
+{
+	return (mask.low != 0) ? PopMaskGrid(mask.low) : 64 + PopMaskGrid(mask.high);
+}
+
+// splitmix64 finalizer, every input bit reaches every output bit
+inline uint64_t MixHash(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+inline uint64_t HashMask(uint64_t mask, uint64_t seed) { return MixHash(mask ^ MixHash(seed)); }
+inline uint64_t HashMask(const GridMask128 &mask, uint64_t seed) { return MixHash(mask.high ^ HashMask(mask.low, seed)); }
+
+// shift towards higher grid ids for positive n, 0 < |n| < 64
+template<int n> inline uint64_t ShiftMask(uint64_t mask) { return (n > 0) ? mask << (n & 63) : mask >> (-n & 63); }
+
+template<int n> inline GridMask128 ShiftMask(const GridMask128 &mask)
+{
+	if (n > 0)
+		return { mask.low << (n & 63), (mask.high << (n & 63)) | (mask.low >> ((64 - n) & 63)) };
+	return { (mask.low >> (-n & 63)) | (mask.high << ((64 + n) & 63)), mask.high >> (-n & 63) };
+}
+
+// bits [64 * part, 64 * part + 64) of the grids on the board, optionally without the first / last column
+constexpr uint64_t MakeColumnMask(int size, int part, bool skipFirstCol, bool skipLastCol)
+{
+	uint64_t mask = 0;
+	for (int bit = 0; bit < 64; ++bit)
+	{
+		int id = part * 64 + bit;
+		if (id < size * size && !(skipFirstCol && id % size == 0) && !(skipLastCol && id % size == size - 1))
+			mask |= 1ULL << bit;
+	}
+	return mask;
+}
+
+inline uint64_t MakeGridMask(uint64_t low, uint64_t, uint64_t*) { return low; }
+inline GridMask128 MakeGridMask(uint64_t low, uint64_t high, GridMask128*) { return { low, high }; }
+
+// Move generation and flips on grid masks, specialized for each board size at
+// compile time. Grids are row major, a step in a direction is a shift of the
+// mask, masked so that it does not wrap around a row or leave the board.
+template<int SIZE>
+class BitBoard
+{
+public:
+	typedef typename GridMaskType<SIZE>::Type Mask;
+
+	static Mask CalcMoves(const Mask &own, const Mask &other)
+	{
+		Mask moves = Mask();
+		AddMoves<1>(own, other, moves);
+		AddMoves<-1>(own, other, moves);
+		AddMoves<SIZE>(own, other, moves);
+		AddMoves<-SIZE>(own, other, moves);
+		AddMoves<SIZE + 1>(own, other, moves);
+		AddMoves<-SIZE - 1>(own, other, moves);
+		AddMoves<SIZE - 1>(own, other, moves);
+		AddMoves<-SIZE + 1>(own, other, moves);
+		return moves & ~(own | other);
+	}
+
+	static Mask CalcFlips(const Mask &own, const Mask &other, int id)
+	{
+		Mask grid = Mask();
+		SetMaskGrid(grid, id);
+
+		Mask flips = Mask();
+		AddFlips<1>(own, other, grid, flips);
+		AddFlips<-1>(own, other, grid, flips);
+		AddFlips<SIZE>(own, other, grid, flips);
+		AddFlips<-SIZE>(own, other, grid, flips);
+		AddFlips<SIZE + 1>(own, other, grid, flips);
+		AddFlips<-SIZE - 1>(own, other, grid, flips);
+		AddFlips<SIZE - 1>(own, other, grid, flips);
+		AddFlips<-SIZE + 1>(own, other, grid, flips);
+		return flips;
+	}
+
+	// grids next to any grid of the mask
+	static Mask CalcNeighbors(const Mask &mask)
+	{
+		return Step<1>(mask) | Step<-1>(mask) | Step<SIZE>(mask) | Step<-SIZE>(mask)
+			| Step<SIZE + 1>(mask) | Step<-SIZE - 1>(mask) | Step<SIZE - 1>(mask) | Step<-SIZE + 1>(mask);
+	}
+
+	// Lower bound of the own discs that can never be flipped. Along each of the
+	// 4 lines through it a stable disc has a full line, the edge or another
+	// stable own disc next to it, which covers corners, edges and filled lines.
+	static Mask CalcStable(const Mask &own, const Mask &other)
+	{
+		Mask filled = own | other;
+		Mask rowSafe = FullLines<1>(filled) | EdgeLines<1>();
+		Mask colSafe = FullLines<SIZE>(filled) | EdgeLines<SIZE>();
+		Mask diagSafe = FullLines<SIZE + 1>(filled) | EdgeLines<SIZE + 1>();
+		Mask antiSafe = FullLines<SIZE - 1>(filled) | EdgeLines<SIZE - 1>();
+
+		// stable discs only grow, repeated until a pass adds none
+		Mask stable = Mask();
+		while (true)
+		{
+			Mask next = own & (rowSafe | Step<1>(stable) | Step<-1>(stable)) & (colSafe | Step<SIZE>(stable) | Step<-SIZE>(stable))
+				& (diagSafe | Step<SIZE + 1>(stable) | Step<-SIZE - 1>(stable)) & (antiSafe | Step<SIZE - 1>(stable) | Step<-SIZE + 1>(stable));
+			if (IsMaskEmpty(next & ~stable))
+				return stable;
+			stable = next;
+		}
+	}
+
+	// grids a step in direction n may land on, word part of the mask, a step to the right must not land in the first column
+	template<int n>
+	static constexpr uint64_t GetStepMask(int part)
+	{
+		return MakeColumnMask(SIZE, part, n == 1 || n == SIZE + 1 || n == -SIZE + 1, n == -1 || n == -SIZE - 1 || n == SIZE - 1);
+	}
+
+private:
+	template<int n>
+	static Mask Step(const Mask &mask)
+	{
+		constexpr uint64_t low = GetStepMask<n>(0);
+		constexpr uint64_t high = GetStepMask<n>(1);
+		return ShiftMask<n>(mask) & MakeGridMask(low, high, (Mask*)NULL);
+	}
+
+	static Mask AllGrids()
+	{
+		constexpr uint64_t low = MakeColumnMask(SIZE, 0, false, false);
+		constexpr uint64_t high = MakeColumnMask(SIZE, 1, false, false);
+		return MakeGridMask(low, high, (Mask*)NULL);
+	}
+
+	// grids missing a neighbor on the line of direction n
+	template<int n>
+	static Mask EdgeLines()
+	{
+		Mask all = AllGrids();
+		return all & ~(Step<n>(all) & Step<-n>(all));
+	}
+
+	// grids whose whole line of direction n is filled, an empty grid reaches its line in SIZE - 1 steps
+	template<int n>
+	static Mask FullLines(const Mask &filled)
+	{
+		Mask open = AllGrids() & ~filled;
+		for (int i = 0; i < SIZE - 1; ++i)
+			open |= Step<n>(open) | Step<-n>(open);
+		return filled & ~open;
+	}
+
+	template<int n>
+	static void AddMoves(const Mask &own, const Mask &other, Mask &moves)
+	{
+		// a run of other discs starting next to an own disc, the grid behind it is a move
+		Mask run = Step<n>(own) & other;
+		for (int i = 0; i < SIZE - 3; ++i)
+			run |= Step<n>(run) & other;
+		moves |= Step<n>(run);
+	}
+
+	template<int n>
+	static void AddFlips(const Mask &own, const Mask &other, const Mask &grid, Mask &flips)
+	{
+		Mask run = Mask();
+		Mask next = Step<n>(grid);
+		while (!IsMaskEmpty(next & other))
+		{
+			run |= next;
+			next = Step<n>(next);
+		}
+
+		if (!IsMaskEmpty(next & own))
+			flips |= run;
+	}
+};
+
+// feature weights of the softmax playout policy
+const float POLICY_PRIORITY_WEIGHT[3] = { 6.f, 0.f, -4.f };	// by Board::GridPriority
+const float POLICY_FLIP_WEIGHT = -0.05f;
+const float POLICY_FRONTIER_FLIP_WEIGHT = -0.2f;
+const float POLICY_EMPTY_NEIGHBOR_WEIGHT = -0.25f;
+const float POLICY_STABLE_WEIGHT = 1.5f;
+
+const int PATTERN_INSTANCE_NUM = (BOARD_SIZE == 10) ? 80 : 46;
+const int PATTERN_GRID_MAX = 10;	// grids of the largest pattern
+const int PATTERN_REF_MAX = (BOARD_SIZE == 6) ? 11 : 10;	// patterns covering a single grid
+
+enum PatternType
+{
+	E_PATTERN_EDGE_X,		// edge with 2 x-squares
+	E_PATTERN_CORNER_3X3,
+	E_PATTERN_CORNER_2X5,
+	E_PATTERN_LINE_2,		// second row
+	E_PATTERN_LINE_3,
+	E_PATTERN_LINE_4,
+	E_PATTERN_DIAG_8,
+	E_PATTERN_DIAG_7,
+	E_PATTERN_DIAG_6,
+	E_PATTERN_DIAG_5,
+	E_PATTERN_DIAG_4,
+	E_PATTERN_TYPE_MAX,
+};
+
+// Pattern instances are the symmetric copies of each pattern type, an instance
+// is encoded as a base-3 number of its grids (0: empty, 1: black, 2: white).
+class Pattern
+{
+public:
+	static void Init();
+	static int GetTypeSize(int type) { return pow3[typeGridCount[type]]; }
+
+	static bool IsReady;
+	static array<int, PATTERN_GRID_MAX + 1> pow3;
+	static array<int, E_PATTERN_TYPE_MAX> typeGridCount;
+	static array<int, E_PATTERN_TYPE_MAX> typeInstanceCount;
+
+	static array<uint8_t, PATTERN_INSTANCE_NUM> instanceType;
+	static array<array<uint8_t, PATTERN_GRID_MAX>, PATTERN_INSTANCE_NUM> instanceGrids;
+
+	static array<uint8_t, GRID_NUM> gridRefCount;
+	static array<array<uint8_t, PATTERN_REF_MAX>, GRID_NUM> gridRefInstance;
+	static array<array<uint16_t, PATTERN_REF_MAX>, GRID_NUM> gridRefPow3;
+};
+
 class Board
 {
 public:
@@ -26,18 +328,6 @@ public:
 		E_INVALID,
 	};
 	
-	enum ChessDirection 
-	{
-		E_L_R,
-		E_R_L,
-		E_T_B,
-		E_B_T,
-		E_TL_BR,
-		E_BR_TL,
-		E_TR_BL,
-		E_BL_TR,
-	};
-
 	enum GridType
 	{
 		E_MAYBE_TYPE,
@@ -56,12 +346,19 @@ public:
 	Board();
 
 	void Clear();
-	char GetGrid(int id) { return grids[id]; }
+	char GetGrid(int id) const { return grids[id]; }
+	const GridMask& GetDiscMask(int side) const { return discMasks[side]; }
+	int GetPatternCode(int instance) const { return patternCodes[instance]; }
 	char GetGridType(int id) { return gridCheckStatus[id]; }
 	void SetGrid(int id, char value, bool needReverse = true);
 	void CheckGridStatus(int side);
 	void GetValidGridsByPriority(GridPriority priority, array<uint8_t, GRID_NUM> &validGrids, int &validGridCount);
+	void GetAllValidGrids(array<uint8_t, GRID_NUM> &validGrids, int &validGridCount);
+	int GetGridPriority(int id) { return Board::gridPriorityDict[priorityDictKey][id]; }
+	static int GetGridPriority(int key, int id) { return Board::gridPriorityDict[key][id]; }
+	void CalcMoveFeatures(int side, int id, int &flips, int &frontierFlips, int &emptyNeighbors, bool &isStable);
 	bool IsKeyGridsValid();
+	int CountStable(int side) const { return CountMaskGrids(BitBoard<BOARD_SIZE>::CalcStable(discMasks[side], discMasks[GetOtherSide(side)])); }
 	void Print(int lastMove);
 
 	static int Coord2Id(int row, int col);
@@ -76,8 +373,6 @@ private:
 	char GetGrid(int row, int col);
 
 	void MarkNearGrids(int id);
-	bool TryReverseInDirection(int side, int id, ChessDirection dir, bool isChange);
-	bool TryReverseInDirectionReal(int side, int row, int col, int dx, int dy, bool isChange);
 	void UpdatePriorityDictKey();
 
 	void PrintSplitLine(int i);
@@ -87,10 +382,14 @@ private:
 	static array<array<char, GRID_NUM>, GRID_PRIORITY_DICT_NUM> gridPriorityDict;
 
 	array<char, GRID_NUM> grids;
+	array<GridMask, 3> discMasks;	// by Chess, E_EMPTY unused
 	array<char, GRID_NUM> gridCheckStatus;
+	array<uint16_t, PATTERN_INSTANCE_NUM> patternCodes;
 	int priorityDictKey;
 };
 
+class PlayoutHistory;
+
 class GameBase
 {
 public:
@@ -105,15 +404,19 @@ public:
 
 	GameBase();
 	void Init();
+	bool SetPosition(const array<char, GRID_NUM> &grids, int side);
 	bool PutChess(int id);
-	bool PutRandomChess();
+	bool PutRecordMove(int id);
+	bool PutRandomChess(const PlayoutHistory *history = NULL);
+	bool PutPolicyChess(const PlayoutHistory *history = NULL);
 	int GetSide();
 	bool IsGameFinishThisTurn();
 	bool IsGameFinish();
 	void UpdateValidGrids();
-	bool UpdateValidGridsExtra();
 	bool IsOverwhelming();
+	int CalcStableWinner();
 	int CalcBetterSide();
+	uint64_t CalcPositionKey();	// discs and side to move
 
 	Board board;
 	int state;
@@ -131,9 +434,12 @@ class Game : private GameBase
 public:
 	int GetState() { return state; }
 	int GetTurn() { return turn; }
+	int GetSide() { return GameBase::GetSide(); }
+	int GetEmptyCount() { return GRID_NUM - board.blackCount - board.whiteCount; }
 	bool IsGameFinish() { return GameBase::IsGameFinish(); }
 
 	bool PutChess(int id);
+	bool SetPosition(const array<char, GRID_NUM> &grids, int side);
 	void Regret(int step = 2);
 	void Reset();
 	void Print();
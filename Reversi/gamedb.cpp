@@ -0,0 +1,346 @@
+#include <fstream>
+#include <filesystem>
+#include "gamedb.h"
+
+const int	GAME_DB_MOVE_MAX = GRID_NUM - 4;
+const int	GAME_DB_PLAYER_MAX = 65535;
+
+GameDbWriter::GameDbWriter()
+{
+	dataFile = indexFile = playerFile = NULL;
+	dataSize = gameCount = 0;
+}
+
+GameDbWriter::~GameDbWriter()
+{
+	Close();
+}
+
+bool GameDbWriter::Open(const string &file)
+{
+	Close();
+
+	if (!filesystem::exists(file))
+	{
+		FILE *fp;
+		GameDbFileHeader header = { GAME_DB_MAGIC, GAME_DB_VERSION };
+		if (fopen_s(&fp, file.c_str(), "wb") != 0)
+			return false;
+		fwrite(&header, sizeof(header), 1, fp);
+		fclose(fp);
+
+		if (fopen_s(&fp, (file + ".idx").c_str(), "wb") != 0)
+			return false;
+		header.magic = GAME_DB_INDEX_MAGIC;
+		fwrite(&header, sizeof(header), 1, fp);
+		fclose(fp);
+
+		if (fopen_s(&fp, (file + ".players").c_str(), "wb") != 0)
+			return false;
+		fclose(fp);
+	}
+
+	if (!Repair(file))
+		return false;
+
+	if (fopen_s(&dataFile, file.c_str(), "ab") != 0 || fopen_s(&indexFile, (file + ".idx").c_str(), "ab") != 0
+		|| fopen_s(&playerFile, (file + ".players").c_str(), "ab") != 0)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void GameDbWriter::Close()
+{
+	lock_guard<mutex> lock(writerMtx);
+	if (dataFile != NULL)
+		fclose(dataFile);
+	if (indexFile != NULL)
+		fclose(indexFile);
+	if (playerFile != NULL)
+		fclose(playerFile);
+
+	dataFile = indexFile = playerFile = NULL;
+	playerIds.clear();
+}
+
+bool GameDbWriter::Repair(const string &file)
+{
+	// a killed writer may leave a record without its index entry or a partial one,
+	// index entries are checked against the data, then data behind them is indexed or cut
+	ifstream data(file, ios::binary);
+	GameDbFileHeader header;
+	if (!data.read((char*)&header, sizeof(header)) || header.magic != GAME_DB_MAGIC || header.version != GAME_DB_VERSION)
+		return false;
+
+	error_code error;
+	dataSize = filesystem::file_size(file, error);
+	uint64_t indexSize = filesystem::file_size(file + ".idx", error);
+	if (error)
+		indexSize = 0; // rebuilt from the data
+
+	vector<uint64_t> offsets;
+	if (indexSize > sizeof(GameDbFileHeader))
+	{
+		ifstream index(file + ".idx", ios::binary);
+		offsets.resize((indexSize - sizeof(GameDbFileHeader)) / sizeof(uint64_t));
+		index.seekg(sizeof(GameDbFileHeader));
+		index.read((char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+		offsets.resize(index.gcount() / sizeof(uint64_t));
+	}
+
+	// returns the end of a complete record at offset, 0 if it is cut
+	auto recordEnd = [&](uint64_t offset) -> uint64_t
+	{
+		GameDbRecord record;
+		data.clear();
+		data.seekg(offset);
+		if (offset + sizeof(record) > dataSize || !data.read((char*)&record, sizeof(record)))
+			return 0;
+
+		uint64_t end = offset + sizeof(record) + GetPackedSize(record.moveCount);
+		return (end <= dataSize) ? end : 0;
+	};
+
+	uint64_t end = sizeof(GameDbFileHeader);
+	while (!offsets.empty())
+	{
+		uint64_t lastEnd = recordEnd(offsets.back());
+		if (lastEnd > 0)
+		{
+			end = lastEnd;
+			break;
+		}
+		offsets.pop_back();
+	}
+
+	size_t indexedCount = offsets.size();
+	for (uint64_t next = recordEnd(end); next > 0; next = recordEnd(end))
+	{
+		offsets.push_back(end);
+		end = next;
+	}
+	data.close();
+
+	gameCount = offsets.size();
+	if (end != dataSize)
+	{
+		filesystem::resize_file(file, end, error);
+		if (error)
+			return false;
+	}
+	dataSize = end;
+
+	// the index is rewritten when it does not match the data
+	if (indexedCount != offsets.size() || indexSize != sizeof(GameDbFileHeader) + offsets.size() * sizeof(uint64_t))
+	{
+		FILE *fp;
+		if (fopen_s(&fp, (file + ".idx").c_str(), "wb") != 0)
+			return false;
+		GameDbFileHeader indexHeader = { GAME_DB_INDEX_MAGIC, GAME_DB_VERSION };
+		fwrite(&indexHeader, sizeof(indexHeader), 1, fp);
+		fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp);
+		fclose(fp);
+	}
+
+	// players are written before their first game, a partial last line has no game
+	ifstream stream(file + ".players", ios::binary);
+	string line;
+	uint64_t playerSize = 0;
+	while (getline(stream, line) && !stream.eof())
+	{
+		int id = playerIds.size();
+		playerIds[line] = id;
+		playerSize += line.size() + 1;
+	}
+	stream.close();
+	if (filesystem::file_size(file + ".players", error) != playerSize)
+		filesystem::resize_file(file + ".players", playerSize, error);
+
+	return !error;
+}
+
+int GameDbWriter::GetPlayerId(const string &player)
+{
+	auto it = playerIds.find(player);
+	if (it != playerIds.end())
+		return it->second;
+
+	int id = min((int)playerIds.size(), GAME_DB_PLAYER_MAX);
+	if (id < GAME_DB_PLAYER_MAX)
+	{
+		playerIds[player] = id;
+		fprintf(playerFile, "%s\n", player.c_str());
+		fflush(playerFile);
+	}
+	return id;
+}
+
+bool GameDbWriter::Append(const vector<uint8_t> &record, const string &blackPlayer, const string &whitePlayer)
+{
+	GameBase game;
+	vector<uint8_t> moves;
+	for (auto move : record)
+	{
+		if (move >= GRID_NUM) // passes are implied
+			continue;
+		if (!game.PutRecordMove(move) || moves.size() >= GAME_DB_MOVE_MAX)
+			return false;
+		moves.push_back(move);
+	}
+
+	// the pass after the last move is left out as well, it ends the game once neither side can move
+	if (game.state == GameBase::E_PASS)
+	{
+		GameBase passed = game;
+		passed.PutChess(-1);
+		if (passed.IsGameFinish())
+			game = passed;
+	}
+
+	// one buffer per game, the record and its index entry are written together
+	vector<uint8_t> buffer(sizeof(GameDbRecord) + GetPackedSize(moves.size()), 0);
+	GameDbRecord *header = (GameDbRecord*)buffer.data();
+	header->moveCount = moves.size();
+	header->state = game.state;
+	header->discDiff = game.board.blackCount - game.board.whiteCount;
+
+	uint8_t *packed = buffer.data() + sizeof(GameDbRecord);
+	for (size_t i = 0; i < moves.size(); ++i)
+	{
+		int bit = i * GAME_DB_MOVE_BITS;
+		packed[bit / 8] |= moves[i] << (bit % 8);
+		if (bit % 8 + GAME_DB_MOVE_BITS > 8)
+			packed[bit / 8 + 1] |= moves[i] >> (8 - bit % 8);
+	}
+
+	lock_guard<mutex> lock(writerMtx);
+	if (dataFile == NULL)
+		return false;
+
+	header->blackPlayer = GetPlayerId(blackPlayer);
+	header->whitePlayer = GetPlayerId(whitePlayer);
+
+	fwrite(buffer.data(), 1, buffer.size(), dataFile);
+	fflush(dataFile);
+	fwrite(&dataSize, sizeof(dataSize), 1, indexFile);
+	fflush(indexFile);
+
+	dataSize += buffer.size();
+	++gameCount;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+GameDbReader::GameDbReader()
+{
+	offsets = NULL;
+	gameCount = 0;
+}
+
+bool GameDbReader::Open(const string &file)
+{
+	Close();
+	if (!dataMap.Open(file) || !indexMap.Open(file + ".idx"))
+	{
+		Close();
+		return false;
+	}
+
+	const GameDbFileHeader *dataHeader = (const GameDbFileHeader*)dataMap.GetData();
+	const GameDbFileHeader *indexHeader = (const GameDbFileHeader*)indexMap.GetData();
+	if (dataMap.GetSize() < sizeof(GameDbFileHeader) || indexMap.GetSize() < sizeof(GameDbFileHeader)
+		|| dataHeader->magic != GAME_DB_MAGIC || dataHeader->version != GAME_DB_VERSION
+		|| indexHeader->magic != GAME_DB_INDEX_MAGIC || indexHeader->version != GAME_DB_VERSION)
+	{
+		Close();
+		return false;
+	}
+
+	offsets = (const uint64_t*)(indexMap.GetData() + sizeof(GameDbFileHeader));
+	gameCount = (indexMap.GetSize() - sizeof(GameDbFileHeader)) / sizeof(uint64_t);
+
+	// a writer may be appending, only records complete in the mapping are used
+	while (gameCount > 0)
+	{
+		uint64_t offset = offsets[gameCount - 1];
+		if (offset + sizeof(GameDbRecord) <= dataMap.GetSize())
+		{
+			const GameDbRecord *record = (const GameDbRecord*)(dataMap.GetData() + offset);
+			if (offset + sizeof(GameDbRecord) + GameDbWriter::GetPackedSize(record->moveCount) <= dataMap.GetSize())
+				break;
+		}
+		--gameCount;
+	}
+
+	ifstream stream(file + ".players");
+	string line;
+	while (getline(stream, line))
+		players.push_back(line);
+
+	return true;
+}
+
+void GameDbReader::Close()
+{
+	dataMap.Close();
+	indexMap.Close();
+	offsets = NULL;
+	gameCount = 0;
+	players.clear();
+}
+
+const GameDbRecord* GameDbReader::GetRecord(uint64_t index) const
+{
+	if (index >= gameCount)
+		return NULL;
+	return (const GameDbRecord*)(dataMap.GetData() + offsets[index]);
+}
+
+int GameDbReader::GetMove(const GameDbRecord *record, int i)
+{
+	const uint8_t *packed = (const uint8_t*)(record + 1);
+	int bit = i * GAME_DB_MOVE_BITS;
+	int value = packed[bit / 8] >> (bit % 8);
+	if (bit % 8 + GAME_DB_MOVE_BITS > 8)
+		value |= packed[bit / 8 + 1] << (8 - bit % 8);
+	return value & ((1 << GAME_DB_MOVE_BITS) - 1);
+}
+
+bool GameDbReader::GetGame(uint64_t index, GameDbGame &game) const
+{
+	const GameDbRecord *record = GetRecord(index);
+	if (record == NULL)
+		return false;
+
+	game.moves.resize(record->moveCount);
+	for (int i = 0; i < record->moveCount; ++i)
+		game.moves[i] = GetMove(record, i);
+
+	game.state = record->state;
+	game.discDiff = record->discDiff;
+	game.blackPlayer = GetPlayer(record->blackPlayer);
+	game.whitePlayer = GetPlayer(record->whitePlayer);
+	return true;
+}
+
+const string& GameDbReader::GetPlayer(int id) const
+{
+	static const string unknown = "?";
+	return (id < (int)players.size()) ? players[id] : unknown;
+}
+
+bool GameDbReader::IsGameDb(const string &file)
+{
+	FILE *fp;
+	if (fopen_s(&fp, file.c_str(), "rb") != 0)
+		return false;
+
+	GameDbFileHeader header;
+	bool isGameDb = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == GAME_DB_MAGIC;
+	fclose(fp);
+	return isGameDb;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdio>
+#include <mutex>
+#include <map>
+#include "game.h"
+#include "checkpoint.h"
+
+const uint32_t GAME_DB_MAGIC = 0x42445652;		// "RVDB"
+const uint32_t GAME_DB_INDEX_MAGIC = 0x49445652;	// "RVDI"
+const uint32_t GAME_DB_VERSION = 1 + BOARD_FORMAT_TAG;
+const int GAME_DB_MOVE_BITS = (GRID_NUM <= 64) ? 6 : 7;
+
+#pragma pack(push, 1)
+// Leads the data file and the index file.
+struct GameDbFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+// One game in the data file, its moves follow packed at 6 bits each (7 on
+// 10x10), the first move in the lowest bits. Passes are implied by the position.
+struct GameDbRecord
+{
+	uint8_t moveCount;
+	uint8_t state;			// GameBase::State after the last move
+	int8_t discDiff;		// black minus white at the end
+	uint8_t reserved;
+	uint16_t blackPlayer;	// lines of the player file
+	uint16_t whitePlayer;
+};
+#pragma pack(pop)
+
+struct GameDbGame
+{
+	vector<uint8_t> moves;
+	int state;
+	int discDiff;
+	string blackPlayer, whitePlayer;
+};
+
+// Game database "<file>": the data file of records, "<file>.idx" with the
+// offset of every record as uint64 after its header, and "<file>.players"
+// holding one player description (name and engine config) per line.
+
+// Appends games, thread safe. Tails left by a killed writer are cut on open.
+class GameDbWriter
+{
+public:
+	GameDbWriter();
+	~GameDbWriter();
+
+	bool Open(const string &file);
+	void Close();
+	bool IsOpen() { return dataFile != NULL; }
+
+	// replays the record for the result, false if a move is illegal
+	bool Append(const vector<uint8_t> &record, const string &blackPlayer, const string &whitePlayer);
+	uint64_t GetGameCount() { return gameCount; }
+
+	static int GetPackedSize(int moveCount) { return (moveCount * GAME_DB_MOVE_BITS + 7) / 8; }
+
+private:
+	bool Repair(const string &file);
+	int GetPlayerId(const string &player);
+
+	FILE *dataFile, *indexFile, *playerFile;
+	uint64_t dataSize, gameCount;
+	map<string, int> playerIds;
+	mutex writerMtx;
+};
+
+// Maps a database read only, records are read in place for sequential and
+// random access. Games appended after Open are not seen.
+class GameDbReader
+{
+public:
+	GameDbReader();
+
+	bool Open(const string &file);
+	void Close();
+
+	uint64_t GetGameCount() const { return gameCount; }
+	const GameDbRecord* GetRecord(uint64_t index) const;
+	bool GetGame(uint64_t index, GameDbGame &game) const;
+	const string& GetPlayer(int id) const;
+
+	static int GetMove(const GameDbRecord *record, int i);
+	static bool IsGameDb(const string &file);
+
+private:
+	MappedFile dataMap, indexMap;
+	const uint64_t *offsets;
+	uint64_t gameCount;
+	vector<string> players;
+};
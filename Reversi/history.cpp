@@ -0,0 +1,68 @@
+#include "history.h"
+
+const float	HISTORY_REPLY_WEIGHT = 1.5f;	// softmax score of the last good reply
+const float	HISTORY_WIN_WEIGHT = 2.f;		// softmax score per win rate above 0.5
+const uint32_t	HISTORY_MIN_VISITS = 8;		// visits before the win rate of a grid counts
+
+PlayoutHistory::PlayoutHistory()
+{
+	Clear();
+}
+
+void PlayoutHistory::Clear()
+{
+	for (int s = 0; s < 2; ++s)
+	{
+		for (int i = 0; i <= GRID_NUM; ++i)
+		{
+			replies[s][i].store(-1, memory_order_relaxed);
+			for (int j = 0; j < GRID_NUM; ++j)
+			{
+				wins[s][i][j].store(0, memory_order_relaxed);
+				visits[s][i][j].store(0, memory_order_relaxed);
+			}
+		}
+	}
+}
+
+int PlayoutHistory::GetReply(int side, int lastMove) const
+{
+	return replies[side - 1][(lastMove < 0) ? GRID_NUM : lastMove].load(memory_order_relaxed);
+}
+
+float PlayoutHistory::CalcBonus(int side, int lastMove, int id) const
+{
+	int last = (lastMove < 0) ? GRID_NUM : lastMove;
+	float bonus = (replies[side - 1][last].load(memory_order_relaxed) == id) ? HISTORY_REPLY_WEIGHT : 0.f;
+
+	uint32_t visit = visits[side - 1][last][id].load(memory_order_relaxed);
+	if (visit >= HISTORY_MIN_VISITS)
+		bonus += HISTORY_WIN_WEIGHT * ((float)wins[side - 1][last][id].load(memory_order_relaxed) / visit - 0.5f);
+	return bonus;
+}
+
+void PlayoutHistory::Update(int firstSide, int lastMove, const uint8_t *moves, int moveCount, int winner)
+{
+	int last = (lastMove < 0) ? GRID_NUM : lastMove;
+	for (int i = 0; i < moveCount; last = moves[i++])
+	{
+		int side = (i % 2 == 0) ? firstSide : Board::GetOtherSide(firstSide);
+		int move = moves[i];
+		if (move == GRID_NUM)
+			continue;
+
+		// a draw teaches the win rates only, the replies are kept
+		visits[side - 1][last][move].fetch_add(1, memory_order_relaxed);
+		if (winner == side)
+		{
+			wins[side - 1][last][move].fetch_add(1, memory_order_relaxed);
+			replies[side - 1][last].store(move, memory_order_relaxed);
+		}
+		else if (winner != GameBase::E_DRAW)
+		{
+			// forget a reply that lost
+			int8_t expected = move;
+			replies[side - 1][last].compare_exchange_strong(expected, -1, memory_order_relaxed);
+		}
+	}
+}
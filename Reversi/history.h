@@ -0,0 +1,24 @@
+#pragma once
+#include <atomic>
+#include "game.h"
+
+// Playout memory of one search, shared by its threads without a lock: the
+// last good reply and the win rate of each grid by side and previous move.
+// Relaxed atomics only, a lost update between threads costs nothing.
+class PlayoutHistory
+{
+public:
+	PlayoutHistory();
+	void Clear();
+
+	int GetReply(int side, int lastMove) const;	// grid, -1: none
+	float CalcBonus(int side, int lastMove, int id) const;	// added to the softmax score of a move
+
+	// moves[i] is played by firstSide on even i, GRID_NUM: pass, winner is a GameBase::State
+	void Update(int firstSide, int lastMove, const uint8_t *moves, int moveCount, int winner);
+
+private:
+	atomic<int8_t> replies[2][GRID_NUM + 1];	// by side and previous move, GRID_NUM: pass or none
+	atomic<uint32_t> wins[2][GRID_NUM + 1][GRID_NUM];
+	atomic<uint32_t> visits[2][GRID_NUM + 1][GRID_NUM];
+};
@@ -1,5 +1,12 @@
 #include "game.h"
 #include "mcts.h"
+#include "arena.h"
+#include "train.h"
+#include "tuner.h"
+#include "protocol.h"
+#include "analyzer.h"
+#include "distributed.h"
+#include "selftest.h"
 #include <ctime>
 
 bool TurnHuman(MCTS &ai, Game &g, bool useAI)
@@ -55,10 +62,269 @@ void TurnAI(MCTS &ai, Game &g)
 	g.PutChess(aiMove);
 }
 
-int main()
+// reversi logview [log file]
+int RunLogView(int argc, char *argv[])
+{
+	string logFile = (argc > 2) ? argv[2] : "MCTS.bin";
+	if (!SearchLogger::Render(logFile))
+	{
+		cout << "Cannot open log file: " << logFile << endl;
+		return 1;
+	}
+	return 0;
+}
+
+// reversi train [key=value ...] <record files ...>
+int RunTrain(int argc, char *argv[])
+{
+	TrainOptions options;
+	vector<string> files;
+	for (int i = 2; i < argc; ++i)
+	{
+		string arg = argv[i];
+		size_t pos = arg.find('=');
+		if (pos == string::npos)
+		{
+			files.push_back(arg);
+		}
+		else if (!options.Set(arg.substr(0, pos), arg.substr(pos + 1)))
+		{
+			cout << "Invalid train option: " << arg << endl;
+			return 1;
+		}
+	}
+
+	if (files.empty())
+	{
+		cout << "No game record file given" << endl;
+		return 1;
+	}
+
+	Trainer trainer(options);
+	return trainer.Run(files) ? 0 : 1;
+}
+
+// reversi tune [key=value ...]
+int RunTune(int argc, char *argv[])
+{
+	TuneOptions options;
+	for (int i = 2; i < argc; ++i)
+	{
+		string arg = argv[i];
+		size_t pos = arg.find('=');
+		if (pos == string::npos || !options.Set(arg.substr(0, pos), arg.substr(pos + 1)))
+		{
+			cout << "Invalid tune option: " << arg << endl;
+			return 1;
+		}
+	}
+
+	Tuner tuner(options);
+	return tuner.Run() ? 0 : 1;
+}
+
+// reversi arena <engine1 config> <engine2 config> [key=value ...]
+int RunArena(int argc, char *argv[])
+{
+	ArenaEngine engines[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		engines[i].name = "engine" + to_string(i + 1);
+		engines[i].config.threadNum = 1;
+		engines[i].config.logLevel = E_LOG_NONE;
+
+		if (i + 2 < argc && !engines[i].config.Parse(argv[i + 2]))
+		{
+			cout << "Invalid engine config: " << argv[i + 2] << endl;
+			return 1;
+		}
+	}
+
+	ArenaOptions options;
+	for (int i = 4; i < argc; ++i)
+	{
+		string arg = argv[i];
+		size_t pos = arg.find('=');
+		if (pos == string::npos || !options.Set(arg.substr(0, pos), arg.substr(pos + 1)))
+		{
+			cout << "Invalid arena option: " << arg << endl;
+			return 1;
+		}
+	}
+
+	Arena arena(engines[0], engines[1], options);
+	arena.Run();
+	return 0;
+}
+
+// reversi gtp [engine config]
+int RunProtocol(int argc, char *argv[])
+{
+	// stdout belongs to the protocol, search logs go to the binary log only
+	MCTSConfig config;
+	config.logLevel = E_LOG_NONE;
+	if (argc > 2 && !config.Parse(argv[2]))
+	{
+		cout << "Invalid engine config: " << argv[2] << endl;
+		return 1;
+	}
+
+	ProtocolEngine engine(config);
+	engine.Run(cin);
+	return 0;
+}
+
+// reversi dbdump <game database> [first game] [game count]
+int RunDbDump(int argc, char *argv[])
+{
+	GameDbReader reader;
+	if (argc < 3 || !reader.Open(argv[2]))
+	{
+		cout << "Cannot open game database: " << ((argc > 2) ? argv[2] : "") << endl;
+		return 1;
+	}
+
+	uint64_t first = (argc > 3) ? stoull(argv[3]) : 0;
+	uint64_t count = (argc > 4) ? stoull(argv[4]) : reader.GetGameCount();
+	const char *resultText[] = { "*", "1-0", "0-1", "1/2-1/2", "*" };
+
+	// one text record per game, same as the arena record file plus the result and players
+	GameDbGame game;
+	for (uint64_t i = first; i < first + count && reader.GetGame(i, game); ++i)
+	{
+		string moves;
+		for (auto move : game.moves)
+			moves += Game::Id2Str(move);
+		printf("%s\t%s\t%+d\t%s\t%s\n", moves.c_str(), resultText[game.state], game.discDiff, game.blackPlayer.c_str(), game.whitePlayer.c_str());
+	}
+	return 0;
+}
+
+// reversi analyze <input file> <output file> [engine config] [key=value ...]
+int RunAnalyze(int argc, char *argv[])
+{
+	if (argc < 4)
+	{
+		cout << "Usage: reversi analyze <input file> <output file> [engine config] [key=value ...]" << endl;
+		return 1;
+	}
+
+	MCTSConfig config;
+	config.threadNum = 1;
+	if (argc > 4 && !config.Parse(argv[4]))
+	{
+		cout << "Invalid engine config: " << argv[4] << endl;
+		return 1;
+	}
+
+	AnalyzerOptions options;
+	for (int i = 5; i < argc; ++i)
+	{
+		string arg = argv[i];
+		size_t pos = arg.find('=');
+		if (pos == string::npos || !options.Set(arg.substr(0, pos), arg.substr(pos + 1)))
+		{
+			cout << "Invalid analyze option: " << arg << endl;
+			return 1;
+		}
+	}
+
+	Analyzer analyzer(config, options);
+	return analyzer.Run(argv[2], argv[3]) ? 0 : 1;
+}
+
+// reversi worker [host:]port [engine config]
+int RunWorker(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cout << "Usage: reversi worker [host:]port [engine config]" << endl;
+		return 1;
+	}
+
+	MCTSConfig config;
+	config.logLevel = E_LOG_NONE;
+	if (argc > 3 && !config.Parse(argv[3]))
+	{
+		cout << "Invalid engine config: " << argv[3] << endl;
+		return 1;
+	}
+
+	// loopback unless an address is given, the port takes any search request
+	string address = argv[2];
+	size_t colon = address.rfind(':');
+	string host = (colon == string::npos) ? "127.0.0.1" : address.substr(0, colon);
+	int port = atoi(address.substr(colon + 1).c_str());
+	if (port <= 0 || port > 65535)
+	{
+		cout << "Invalid port: " << argv[2] << endl;
+		return 1;
+	}
+
+	// workers started in the same second must not search with the same random numbers
+	srand((unsigned)time(NULL) ^ ((unsigned)port * 2654435761u));
+
+	SearchWorker worker(config);
+	return worker.Run(host, port) ? 0 : 1;
+}
+
+// reversi netconvert <float weights> [network file]
+int RunNetConvert(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cout << "Usage: reversi netconvert <float weights> [network file]" << endl;
+		return 1;
+	}
+
+	return Network::Convert(argv[2], (argc > 3) ? argv[3] : NETWORK_FILE) ? 0 : 1;
+}
+
+// reversi test [work dir]
+int RunSelfTest(int argc, char *argv[])
+{
+	SelfTest test((argc > 2) ? argv[2] : ".");
+	return test.Run() ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
 {
 	srand((unsigned)time(NULL));
 
+	// trained evaluation weights are optional, built-in defaults are used without them
+	Evaluator::LoadWeights(EVAL_WEIGHT_FILE);
+	Network::Load(NETWORK_FILE);
+
+	if (argc > 1 && string(argv[1]) == "arena")
+		return RunArena(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "tune")
+		return RunTune(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "logview")
+		return RunLogView(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "train")
+		return RunTrain(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "gtp")
+		return RunProtocol(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "analyze")
+		return RunAnalyze(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "dbdump")
+		return RunDbDump(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "worker")
+		return RunWorker(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "netconvert")
+		return RunNetConvert(argc, argv);
+
+	if (argc > 1 && string(argv[1]) == "test")
+		return RunSelfTest(argc, argv);
+
 	MCTS ai1(0), ai2(0);
 	Game g;
 
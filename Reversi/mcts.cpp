@@ -3,10 +3,18 @@
 #include <mutex>
 #include <cmath>
 #include <cstdlib>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include "mcts.h"
+#include "distributed.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
-const char* LOG_FILE = "MCTS.log";
-const char* LOG_FILE_FULL = "MCTS_FULL.log";
 const float Cp = 2.0f;
 const float SEARCH_TIME = 0.5f;
 const int	EXPAND_THRESHOLD = 1;
@@ -15,32 +23,268 @@ const bool	ENABLE_MULTI_THREAD = true;
 const float	FAST_STOP_THRESHOLD = 0.1f;
 const float	FAST_STOP_BRANCH_FACTOR = 0.01f;
 
+const int	EVAL_MODE = E_EVAL_ROLLOUT;
+const float	EVAL_CUT_THRESHOLD = 16.f;
+
+const int	PLAYOUT_POLICY = E_PLAYOUT_RANDOM;	// softmax has not shown a significant gain yet
+const float	PUCT_C = 1.5f;
+const int	ROLLOUT_BATCH = 1;	// batched playouts have not shown a gain in a match yet
+const int	LEAF_PLAYOUTS = 1;
+const int	RAVE_EQUIVALENCE = 0;
+const int	SOLVE_EMPTIES = 0;			// off, exact tails have not shown a significant gain yet
+const int	SOLVE_EMPTIES_MAX = 12;		// larger tails stall the playout solving them
+const int	LEAF_PLAYOUT_DEPTH_STEP = 8;		// one more playout per this many plies below the root
+const float	LEAF_PLAYOUT_CONTENTION = 0.25f;	// share of contended locks doubling the playouts of a leaf
+const float	CONTENTION_DECAY = 0.05f;
+
 const bool	ENABLE_TRY_MORE_NODE = true;
-const int	TRY_MORE_NODE_THRESHOLD = 1000;
+const int	TRY_MORE_NODE_THRESHOLD = 1000;	// visits for the first grid below the top priority, k grids need k * k times
+
+const int	INV_SQRT_TABLE_SIZE = 4096;
+
+const int	MEMORY_LIMIT_MB = 1024;
+const float	PRUNE_RATIO = 0.25f;	// part of the node budget freed by one pruning
+
+const float	CHECKPOINT_INTERVAL = 60.f;
+const int	CHECKPOINT_WRITE_CHUNK = 4096;	// nodes per fwrite
+
+const int	POSITION_CACHE_SIZE_MB = 256;
+const int	POSITION_CACHE_STORE_VISITS = 200;	// visits of a node in one search to be merged into the cache
+const int	POSITION_CACHE_SEED_VISITS = 100;	// most visits a new node takes from the cache
+
+const float	REMOTE_FINISH_TIMEOUT = 2.f;	// seconds to wait for the final reports of remote workers
+
+// sqrtf(1.f / visit) of small visit counts, looked up on every backup
+struct InvSqrtTable
+{
+	InvSqrtTable()
+	{
+		values[0] = 0;
+		for (int i = 1; i < INV_SQRT_TABLE_SIZE; ++i)
+			values[i] = sqrtf(1.f / i);
+	}
+
+	float values[INV_SQRT_TABLE_SIZE];
+} invSqrtTable;
+
+inline float InvSqrt(int visit)
+{
+	return (visit < INV_SQRT_TABLE_SIZE) ? invSqrtTable.values[visit] : sqrtf(1.f / visit);
+}
+
+void ChildStats::Clear(int count)
+{
+	// padding lanes score -1 and never win the argmax
+	for (int i = 0; i < count; ++i)
+	{
+		winRate[i] = -1;
+		factor[i] = 0;
+	}
+}
+
+// all legal grids, GameBase::validGrids holds the top priority only
+inline GridMask CalcLegalGrids(GameBase &game)
+{
+	if (game.state != GameBase::E_NORMAL)
+		return GridMask();
+
+	int side = game.GetSide();
+	return BitBoard<BOARD_SIZE>::CalcMoves(game.board.GetDiscMask(side), game.board.GetDiscMask(Board::GetOtherSide(side)));
+}
 
 TreeNode::TreeNode(TreeNode *p)
 {
 	visit = 0;
 	value = 0;
-	winRate = 0;
-	expandFactor = 0;
+	virtualLosses = 0;
+	childIndex = 0;
 	validGridCount = 0;
-	gridLevel = 0;
 	game = NULL;
 	parent = p;
+	prior = 0;
+	isPending = false;
+	isPinned = false;
+	checkpoint = NULL;
+	raveVisit = 0;
+	raveValue = 0;
+	cacheVisit = 0;
+	cacheValue = 0;
+	stats.Clear(CHILD_NUM_MAX);
 }
 
-FILE *fp;
+MCTSConfig::MCTSConfig()
+{
+	searchTime = SEARCH_TIME;
+	visitLimit = 0;
+	threadNum = ENABLE_MULTI_THREAD ? 0 : 1;
+	logLevel = E_LOG_TREE;
+	logSample = 1;
+	evalMode = EVAL_MODE;
+	evalCut = EVAL_CUT_THRESHOLD;
+	playoutPolicy = PLAYOUT_POLICY;
+	cPuct = PUCT_C;
+	cUct = Cp;
+	expandThreshold = EXPAND_THRESHOLD;
+	fastStopThreshold = FAST_STOP_THRESHOLD;
+	fastStopBranchFactor = FAST_STOP_BRANCH_FACTOR;
+	tryMoreThreshold = TRY_MORE_NODE_THRESHOLD;
+	networkBatch = 0;
+	rolloutBatch = ROLLOUT_BATCH;
+	leafPlayouts = LEAF_PLAYOUTS;
+	isLeafPlayoutAdaptive = true;
+	raveEquivalence = RAVE_EQUIVALENCE;
+	isPlayoutHistory = false;
+	solveEmpties = SOLVE_EMPTIES;
+	priority = 0;
+	memoryLimit = MEMORY_LIMIT_MB;
+	checkpointInterval = CHECKPOINT_INTERVAL;
+	positionCacheSize = POSITION_CACHE_SIZE_MB;
+}
 
-MCTS::MCTS(int mode)
+bool MCTSConfig::Parse(const string &text)
+{
+	stringstream ss(text);
+	string item;
+	while (getline(ss, item, ','))
+	{
+		if (item.empty())
+			continue;
+
+		size_t pos = item.find('=');
+		if (pos == string::npos || !Set(item.substr(0, pos), item.substr(pos + 1)))
+			return false;
+	}
+	return true;
+}
+
+bool MCTSConfig::Set(const string &key, const string &value)
+{
+	if (key == "time")
+		searchTime = stof(value);
+	else if (key == "visits")
+		visitLimit = stoi(value);
+	else if (key == "threads")
+		threadNum = stoi(value);
+	else if (key == "priority")
+		priority = stoi(value);
+	else if (key == "log")
+		logLevel = stoi(value);
+	else if (key == "logsample")
+		logSample = max(stoi(value), 1);
+	else if (key == "eval")
+		evalMode = stoi(value);
+	else if (key == "evalcut")
+		evalCut = stof(value);
+	else if (key == "playout")
+		playoutPolicy = stoi(value);
+	else if (key == "cpuct")
+		cPuct = stof(value);
+	else if (key == "cuct")
+		cUct = stof(value);
+	else if (key == "expand")
+		expandThreshold = max(stoi(value), 1);
+	else if (key == "fstop")
+		fastStopThreshold = stof(value);
+	else if (key == "fsbranch")
+		fastStopBranchFactor = stof(value);
+	else if (key == "trymore")
+		tryMoreThreshold = max(stoi(value), 0);
+	else if (key == "batch")
+		networkBatch = stoi(value);
+	else if (key == "rbatch")
+		rolloutBatch = min(max(stoi(value), 1), ROLLOUT_BATCH_MAX);
+	else if (key == "leafplay")
+		leafPlayouts = min(max(stoi(value), 1), ROLLOUT_BATCH_MAX);
+	else if (key == "leafadapt")
+		isLeafPlayoutAdaptive = stoi(value) != 0;
+	else if (key == "rave")
+		raveEquivalence = max(stoi(value), 0);
+	else if (key == "history")
+		isPlayoutHistory = stoi(value) != 0;
+	else if (key == "solve")
+		solveEmpties = min(max(stoi(value), 0), SOLVE_EMPTIES_MAX);
+	else if (key == "memory")
+		memoryLimit = max(stoi(value), 1);
+	else if (key == "checkpoint")
+		checkpointFile = value;
+	else if (key == "ckptint")
+		checkpointInterval = stof(value);
+	else if (key == "pcache")
+		positionCacheFile = value;
+	else if (key == "pcachesize")
+		positionCacheSize = max(stoi(value), 1);
+	else if (key == "remote")
+		remoteWorkers = value;
+	else
+		return false;
+
+	return true;
+}
+
+string MCTSConfig::ToString() const
+{
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer), "time=%g,visits=%d,threads=%d,priority=%d,log=%d,logsample=%d,eval=%d,evalcut=%g,playout=%d,cpuct=%g,"
+		"cuct=%g,expand=%d,fstop=%g,fsbranch=%g,trymore=%d,batch=%d,rbatch=%d,leafplay=%d,leafadapt=%d,rave=%d,history=%d,solve=%d,memory=%d",
+		searchTime, visitLimit, threadNum, priority, logLevel, logSample, evalMode, evalCut, playoutPolicy, cPuct,
+		cUct, expandThreshold, fastStopThreshold, fastStopBranchFactor, tryMoreThreshold, networkBatch, rolloutBatch,
+		leafPlayouts, isLeafPlayoutAdaptive ? 1 : 0, raveEquivalence, isPlayoutHistory ? 1 : 0, solveEmpties, memoryLimit);
+
+	string text = buffer;
+	if (!checkpointFile.empty())
+	{
+		snprintf(buffer, sizeof(buffer), ",checkpoint=%s,ckptint=%g", checkpointFile.c_str(), checkpointInterval);
+		text += buffer;
+	}
+	if (!positionCacheFile.empty())
+	{
+		snprintf(buffer, sizeof(buffer), ",pcache=%s,pcachesize=%d", positionCacheFile.c_str(), positionCacheSize);
+		text += buffer;
+	}
+	if (!remoteWorkers.empty())
+		text += ",remote=" + remoteWorkers;
+	return text;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+atomic<int> instanceCount(0);
+
+MCTS::MCTS(int mode, const MCTSConfig &config)
 {
 	this->mode = mode;
+	this->config = config;
 
 	root = NULL;
+	Evaluator::Init();
+	RolloutBatch::Init();
+
+	if (this->config.evalMode == E_EVAL_NETWORK && !Network::IsLoaded())
+	{
+		printf("network weights are not loaded, fall back to rollouts\n");
+		this->config.evalMode = E_EVAL_ROLLOUT;
+	}
+	instanceId = instanceCount++;
+	searchCount = 0;
+
+	allocatedNodes = 0;
+	maxNodes = (long long)this->config.memoryLimit * 1024 * 1024 / TREE_NODE_BYTES;
+	prunedNodes = 0;
+	for (int i = 0; i < THREAD_NUM_MAX; ++i)
+	{
+		for (int j = 0; j < ROLLOUT_BATCH_MAX; ++j)
+			threadLeaves[i][j] = NULL;
+		threadContention[i] = 0;
+	}
 
-	// clear log file
-	fopen_s(&fp, LOG_FILE, "w");
-	fclose(fp);
+	checkpointNodes = NULL;
+	checkpointNodeCount = 0;
+	positionCache = NULL;
+	if (!this->config.positionCacheFile.empty())
+		positionCache = PositionCache::Open(this->config.positionCacheFile, this->config.positionCacheSize, this->config.evalMode);
+	isStopRequested = false;
+	remote.reset(new RemoteSearch());
+	playoutHistory.reset(new PlayoutHistory());
 }
 
 MCTS::~MCTS()
@@ -48,160 +292,765 @@ MCTS::~MCTS()
 	ClearPool();
 }
 
-mutex mtx;
+float GetElapsedTime(TimePoint startTime)
+{
+	return chrono::duration<float>(chrono::steady_clock::now() - startTime).count();
+}
 
-void MCTS::SearchThread(int id, int seed, MCTS *mcts, clock_t startTime)
+bool MCTS::RunSlice(int slot, TimePoint sliceEnd)
 {
-	srand(seed); // need to call srand for each thread
-	float elapsedTime = 0;
+#ifdef ENABLE_PROFILE
+	threadProfile = &threadProfiles[slot];
+#endif
 
-	while (1)
+	bool isFinished = false;
+	while (!isFinished && chrono::steady_clock::now() < sliceEnd)
 	{
-		mtx.lock();
-		TreeNode *node = mcts->TreePolicy(mcts->root);
-		mtx.unlock();
+		if (config.evalMode == E_EVAL_NETWORK)
+			RunIterationNetwork(slot);
+		else if (config.evalMode == E_EVAL_ROLLOUT && config.rolloutBatch > 1)
+			RunIterationBatch(slot);
+		else
+			RunIteration(slot);
 
-		float value = mcts->DefaultPolicy(node, id);
+		isFinished = IsSearchFinish();
+	}
 
-		mtx.lock();
-		mcts->UpdateValue(node, value);
-		mtx.unlock();
+#ifdef ENABLE_PROFILE
+	threadProfile = NULL;
+#endif
+	return isFinished;
+}
 
-		elapsedTime = float(clock() - startTime) / 1000;
-		if (elapsedTime > SEARCH_TIME)
+void MCTS::RunIteration(int slot)
+{
+	LockTree(slot);
+	TreeNode *node = TreePolicy(root);
+	int playouts = CalcLeafPlayouts(node, slot);
+	threadLeaves[slot][0] = node;
+	treeMtx.unlock();
+
+	float values[ROLLOUT_BATCH_MAX];
+	array<GridMask, 3> playedGrids[ROLLOUT_BATCH_MAX];
+	float value = 0;
+	for (int i = 0; i < playouts; ++i)
+	{
+		values[i] = DefaultPolicy(node, slot);
+		playedGrids[i] = playoutGrids[slot];
+		value += values[i];
+	}
+
+	LockTree(slot);
+	UpdateValue(node, value, false, playouts);
+	if (IsRaveEnabled())
+	{
+		for (int i = 0; i < playouts; ++i)
+			UpdateRave(node, playedGrids[i], values[i]);
+	}
+	threadLeaves[slot][0] = NULL;
+	CheckVisitLimit();
+	treeMtx.unlock();
+}
+
+void MCTS::RunIterationBatch(int slot)
+{
+	RolloutBatch batch(config.playoutPolicy == E_PLAYOUT_SOFTMAX, config.fastStopThreshold, config.fastStopBranchFactor,
+		config.solveEmpties, config.isPlayoutHistory ? playoutHistory.get() : NULL);
+	TreeNode **leaves = threadLeaves[slot];
+	int playouts[ROLLOUT_BATCH_MAX];
+	int leafCount = 0;
+
+	// virtual loss spreads the leaves of one batch over the tree, the lanes of a leaf follow each other
+	LockTree(slot);
+	while (batch.GetCount() < config.rolloutBatch)
+	{
+		TreeNode *node = TreePolicy(root);
+		AddVirtualLoss(node);
+		leaves[leafCount] = node;
+		playouts[leafCount] = min(CalcLeafPlayouts(node, slot), ROLLOUT_BATCH_MAX - batch.GetCount());
+		for (int i = 0; i < playouts[leafCount]; ++i)
+			batch.Add(*(node->game));
+		leafCount++;
+	}
+	treeMtx.unlock();
+
+	{
+		PROFILE_SCOPE(E_PHASE_DEFAULT_POLICY);
+		batch.Run();
+	}
+
+	int rootSide = root->game->GetSide();
+	LockTree(slot);
+	for (int i = 0, lane = 0; i < leafCount; ++i)
+	{
+		float value = 0;
+		for (int j = 0; j < playouts[i]; ++j, ++lane)
 		{
-			mtx.lock();
-			TreeNode *mostVisit = *max_element(mcts->root->children.begin(), mcts->root->children.end(), [](const TreeNode *a, const TreeNode *b)
+			float playoutValue = (batch.GetWinner(lane) == rootSide) ? 1.f : 0;
+			playoutValue = (playoutValue - 0.5f) * batch.GetWeight(lane) + 0.5f;
+			value += playoutValue;
+
+			if (IsRaveEnabled())
+			{
+				array<GridMask, 3> playedGrids = { GridMask(), batch.GetPlayedGrids(lane, Board::E_BLACK), batch.GetPlayedGrids(lane, Board::E_WHITE) };
+				UpdateRave(leaves[i], playedGrids, playoutValue);
+			}
+
+			int steps = batch.GetSteps(lane);
+			rolloutStats[slot].steps += steps;
+			PROFILE_COUNT(E_COUNTER_ROLLOUT_STEP, steps);
+			if (batch.IsFastStop(lane))
 			{
-				return a->visit < b->visit;
-			});
+				rolloutStats[slot].fastStopCount++;
+				rolloutStats[slot].fastStopSteps += steps;
+				PROFILE_COUNT(E_COUNTER_FAST_STOP, 1);
+			}
+			if (batch.IsStableStop(lane))
+			{
+				rolloutStats[slot].stableStopCount++;
+				rolloutStats[slot].stableStopEmpties += batch.GetEmptyCount(lane);
+				PROFILE_COUNT(E_COUNTER_STABLE_STOP, 1);
+			}
+		}
+		UpdateValue(leaves[i], value, true, playouts[i]);
+		leaves[i] = NULL;
+	}
+	PROFILE_COUNT(E_COUNTER_PLAYOUT, batch.GetCount());
+	CheckVisitLimit();
+	treeMtx.unlock();
+}
 
-			TreeNode *bestScore = mcts->BestChild(mcts->root, 0);
-			mtx.unlock();
+void MCTS::LockTree(int slot)
+{
+	// share of recent lock requests that had to wait
+	bool isContended = !treeMtx.try_lock();
+	if (isContended)
+		PROFILE_LOCK(treeMtx);
+	else
+		PROFILE_COUNT(E_COUNTER_LOCK, 1);
 
-			if (mostVisit == bestScore)
-				break;
+	threadContention[slot] += ((isContended ? 1.f : 0.f) - threadContention[slot]) * CONTENTION_DECAY;
+}
+
+// playouts of one leaf, the descent and backup under the lock are paid once for all of them
+int MCTS::CalcLeafPlayouts(TreeNode *node, int slot)
+{
+	if (config.leafPlayouts == 1 || node->game->IsGameFinish())
+		return 1;
+
+	if (!config.isLeafPlayoutAdaptive)
+		return config.leafPlayouts;
+
+	int depth = 0;
+	for (TreeNode *parent = node->parent; parent != NULL; parent = parent->parent)
+		depth++;
+
+	int playouts = 1 + depth / LEAF_PLAYOUT_DEPTH_STEP;
+	if (threadContention[slot] > LEAF_PLAYOUT_CONTENTION)
+		playouts *= 2;
+	return min(playouts, config.leafPlayouts);
+}
+
+void MCTS::RunIterationNetwork(int slot)
+{
+	array<uint8_t, GRID_NUM> moves;
+	array<float, GRID_NUM> priors;
+	int moveCount = 0;
+
+	// virtual loss keeps other threads off this path while the leaf waits for its batch
+	PROFILE_LOCK(treeMtx);
+	TreeNode *node = TreePolicy(root);
+	bool isCollision = node->isPending;
+	if (!isCollision)
+	{
+		// an expanded node comes back when the memory cap stops expansion, its priors stay
+		node->isPending = !node->game->IsGameFinish() && node->children.empty();
+		AddVirtualLoss(node);
+		threadLeaves[slot][0] = node;
+	}
+	treeMtx.unlock();
+
+	if (isCollision)
+	{
+		this_thread::yield();
+		return;
+	}
+
+	float value = NetworkPolicy(node, moves, priors, moveCount);
+
+	PROFILE_LOCK(treeMtx);
+	if (node->isPending)
+	{
+		ApplyPriors(node, moves, priors, moveCount);
+		node->isPending = false;
+	}
+	UpdateValue(node, value, true);
+	threadLeaves[slot][0] = NULL;
+	CheckVisitLimit();
+	treeMtx.unlock();
+}
+
+inline TreeNode* MostVisitChild(TreeNode *node)
+{
+	return *max_element(node->children.begin(), node->children.end(), [](const TreeNode *a, const TreeNode *b)
+	{
+		return a->visit < b->visit;
+	});
+}
+
+void MCTS::Stop()
+{
+	isStopRequested = true;
+	remote->Stop();
+
+	lock_guard<mutex> lock(stopMtx);
+	stopCv.notify_all();
+}
+
+void MCTS::CheckVisitLimit()
+{
+	// the budget ends the search the same way as a stop
+	if (config.visitLimit > 0 && root->visit >= config.visitLimit && !isStopRequested)
+		Stop();
+}
+
+bool MCTS::GetSearchInfo(SearchInfo &info, int moveCount)
+{
+	lock_guard<mutex> lock(treeMtx);
+	if (root == NULL || root->children.empty())
+		return false;
+
+	info.time = GetElapsedTime(searchStartTime);
+	info.visit = root->visit;
+
+	TreeNode *best = MostVisitChild(root);
+	info.winRate = root->stats.winRate[best->childIndex];
+
+	info.pv.clear();
+	for (TreeNode *node = root; !node->children.empty();)
+	{
+		node = MostVisitChild(node);
+		info.pv.push_back(node->game->lastMove);
+	}
+
+	vector<TreeNode*> children(root->children.begin(), root->children.end());
+	moveCount = min(moveCount, (int)children.size());
+	partial_sort(children.begin(), children.begin() + moveCount, children.end(), [](const TreeNode *a, const TreeNode *b)
+	{
+		return a->visit > b->visit;
+	});
+
+	info.moves.clear();
+	info.moveVisits.clear();
+	info.moveWinRates.clear();
+	for (int i = 0; i < moveCount; ++i)
+	{
+		info.moves.push_back(children[i]->game->lastMove);
+		info.moveVisits.push_back(children[i]->visit);
+		info.moveWinRates.push_back(root->stats.winRate[children[i]->childIndex]);
+	}
+
+	if (remote->IsActive())
+		MergeRemoteInfo(info, moveCount);
+	return true;
+}
+
+bool MCTS::GetShallowStats(vector<ShallowStat> &stats, int depth)
+{
+	lock_guard<mutex> lock(treeMtx);
+	if (root == NULL || root->children.empty())
+		return false;
+
+	vector<int> path;
+	CollectShallowStats(root, path, depth, stats);
+	return true;
+}
+
+void MCTS::CollectShallowStats(TreeNode *node, vector<int> &path, int depth, vector<ShallowStat> &stats)
+{
+	if (depth == 0)
+		return;
+
+	for (auto child : node->children)
+	{
+		if (child->visit == 0)
+			continue;
+
+		path.push_back(child->game->lastMove);
+		stats.push_back({ path, child->visit, node->stats.winRate[child->childIndex] });
+		CollectShallowStats(child, path, depth - 1, stats);
+		path.pop_back();
+	}
+}
+
+void MCTS::MergeRemoteInfo(SearchInfo &info, int moveCount)
+{
+	vector<ShallowStat> stats;
+	vector<int> path;
+	CollectShallowStats(root, path, REMOTE_STAT_DEPTH, stats);
+	remote->MergeStats(stats);
+
+	vector<const ShallowStat*> moves;
+	info.visit = 0;
+	for (auto &stat : stats)
+	{
+		if (stat.path.size() == 1)
+		{
+			moves.push_back(&stat);
+			info.visit += stat.visit;
 		}
 	}
+	sort(moves.begin(), moves.end(), [](const ShallowStat *a, const ShallowStat *b) { return a->visit > b->visit; });
+
+	info.winRate = moves[0]->winRate;
+	info.moves.clear();
+	info.moveVisits.clear();
+	info.moveWinRates.clear();
+	for (int i = 0; i < min(moveCount, (int)moves.size()); ++i)
+	{
+		info.moves.push_back(moves[i]->path[0]);
+		info.moveVisits.push_back(moves[i]->visit);
+		info.moveWinRates.push_back(moves[i]->winRate);
+	}
+
+	// the local line is kept while it starts with the merged best move
+	int bestMove = moves[0]->path[0];
+	if (info.pv.empty() || info.pv[0] != bestMove)
+	{
+		info.pv.assign(1, bestMove);
+		const ShallowStat *reply = NULL;
+		for (auto &stat : stats)
+		{
+			if (stat.path.size() == 2 && stat.path[0] == bestMove && (reply == NULL || stat.visit > reply->visit))
+				reply = &stat;
+		}
+		if (reply != NULL)
+			info.pv.push_back(reply->path[1]);
+	}
+}
+
+int MCTS::RemoteBestMove()
+{
+	vector<ShallowStat> stats;
+	vector<int> path;
+	CollectShallowStats(root, path, 1, stats);
+	remote->MergeStats(stats);
+
+	// the trees vote with their visits, the most visited move over all of them is played
+	const ShallowStat *best = NULL;
+	for (auto &stat : stats)
+	{
+		if (stat.path.size() == 1 && (best == NULL || stat.visit > best->visit))
+			best = &stat;
+	}
+	return (best != NULL) ? best->path[0] : -1;
+}
+
+bool MCTS::IsSearchFinish()
+{
+	if (!isStopRequested && GetElapsedTime(searchStartTime) <= config.searchTime)
+		return false;
+
+	PROFILE_LOCK(treeMtx);
+	if (root->children.empty())
+	{
+		treeMtx.unlock();
+		return false;
+	}
+
+	// PUCT plays the most visited child, there is nothing to wait for
+	if (isStopRequested || config.evalMode == E_EVAL_NETWORK)
+	{
+		treeMtx.unlock();
+		return true;
+	}
+
+	TreeNode *mostVisit = MostVisitChild(root);
+
+	TreeNode *bestScore = BestChild(root, 0);
+	treeMtx.unlock();
+
+	return mostVisit == bestScore;
 }
 
 int MCTS::Search(Game *state)
 {
 	if (state->GetState() == GameBase::E_PASS)
 	{
+		if (moveCallback)
+			moveCallback(-1);
 		return -1;
 	}
 
 	fastStopSteps = 0;
 	fastStopCount = 0;
-
+	stableStopCount = 0;
+	stableStopEmpties = 0;
+	rolloutSteps = 0;
+	memset(rolloutStats, 0, sizeof(rolloutStats));
+	prunedNodes = 0;
+	if (config.isPlayoutHistory)
+		playoutHistory->Clear();
+
+	// GetSearchInfo may look at the root from another thread
+	PROFILE_LOCK(treeMtx);
 	root = NewTreeNode(NULL);
 	*(root->game) = *((GameBase*)state);
-	root->validGridCount = root->game->validGridCount;
-	root->validGrids = root->game->validGrids;
+	SetUnexpandedGrids(root, CalcLegalGrids(*(root->game)));
+
+	if (!config.checkpointFile.empty() && LoadCheckpoint() && config.logLevel != E_LOG_NONE)
+		printf("checkpoint: resumed %llu nodes, %d visits\n", (unsigned long long)checkpointNodeCount, root->visit);
 
-	clock_t startTime = clock();
+	TimePoint startTime = chrono::steady_clock::now();
+	searchStartTime = startTime;
+	treeMtx.unlock();
+#ifdef ENABLE_PROFILE
+	uint64_t startCycle = __rdtsc();
+#endif
 
-	thread threads[THREAD_NUM_MAX];
-	int thread_num = ENABLE_MULTI_THREAD ? thread::hardware_concurrency() : 1;
+	// the workers of the shared scheduler search, this thread only waits
+	SearchScheduler &scheduler = SearchScheduler::Instance();
+	int thread_num = (config.threadNum > 0) ? config.threadNum : scheduler.GetWorkerNum();
+	thread_num = min(max(thread_num, 1), THREAD_NUM_MAX);
 
+	batcher.SetBatchSize((config.networkBatch > 0) ? config.networkBatch : min(thread_num, scheduler.GetWorkerNum()));
+
+#ifdef ENABLE_PROFILE
 	for (int i = 0; i < thread_num; ++i)
-		threads[i] = thread(SearchThread, i, rand(), this, startTime);
+		threadProfiles[i].Clear();
+#endif
+
+	SearchJob job;
+	job.mcts = this;
+	job.deadline = startTime + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<float>(config.searchTime));
+	job.priority = config.priority;
+	job.maxWorkers = thread_num;
+	scheduler.Submit(&job);
+
+	// workers of other processes search the same root until this search ends
+	if (!config.remoteWorkers.empty())
+	{
+		char remoteConfig[256];
+		snprintf(remoteConfig, sizeof(remoteConfig), "time=%g,eval=%d,evalcut=%g,playout=%d,cpuct=%g,cuct=%g,expand=%d,fstop=%g,fsbranch=%g,trymore=%d,solve=%d",
+			config.searchTime, config.evalMode, config.evalCut, config.playoutPolicy, config.cPuct,
+			config.cUct, config.expandThreshold, config.fastStopThreshold, config.fastStopBranchFactor, config.tryMoreThreshold,
+			config.solveEmpties);
+		remote->Start(config.remoteWorkers, *((GameBase*)state), remoteConfig);
+	}
+
+	if (!config.checkpointFile.empty())
+	{
+		// long searches are saved on the way, a killed process loses one interval at most
+		float checkpointTime = config.checkpointInterval;
+		while (checkpointTime < config.searchTime)
+		{
+			unique_lock<mutex> lock(stopMtx);
+			if (stopCv.wait_for(lock, chrono::duration<float>(checkpointTime - GetElapsedTime(startTime)), [this] { return isStopRequested.load(); }))
+				break;
+			lock.unlock();
+
+			// the nodes in memory are copied under the lock, the workers go on while the file is written
+			CheckpointSnapshot snapshot;
+			PROFILE_LOCK(treeMtx);
+			MakeCheckpoint(snapshot);
+			treeMtx.unlock();
+
+			if (WriteCheckpoint(snapshot))
+				MoveFileReplace(config.checkpointFile + ".tmp", config.checkpointFile); // fails on windows while the old file is mapped
+
+			checkpointTime += config.checkpointInterval;
+		}
+	}
+
+	scheduler.Wait(&job);
 
+	if (remote->IsActive())
+	{
+		remote->Stop();
+		remote->Finish(REMOTE_FINISH_TIMEOUT);
+	}
+
+	profile.Clear();
+#ifdef ENABLE_PROFILE
+	profile.cyclesPerSecond = (__rdtsc() - startCycle) / max(GetElapsedTime(startTime), 1e-6f);
 	for (int i = 0; i < thread_num; ++i)
-		threads[i].join();
-	
-	TreeNode *best = BestChild(root, 0);
+		profile.Merge(threadProfiles[i]);
+#endif
+
+	for (int i = 0; i < thread_num; ++i)
+	{
+		fastStopCount += rolloutStats[i].fastStopCount;
+		fastStopSteps += rolloutStats[i].fastStopSteps;
+		stableStopCount += rolloutStats[i].stableStopCount;
+		stableStopEmpties += rolloutStats[i].stableStopEmpties;
+		rolloutSteps += rolloutStats[i].steps;
+	}
+
+	TreeNode *best = (config.evalMode == E_EVAL_NETWORK) ? MostVisitChild(root) : BestChild(root, 0);
 	int move = best->game->lastMove;
+	if (remote->IsActive())
+	{
+		// a merged move may be known to the remote trees only, it is played only when it is legal here
+		int remoteMove = RemoteBestMove();
+		TreeNode *remoteBest = NULL;
+		if (remoteMove >= 0 && remoteMove < GRID_NUM && TestMaskGrid(CalcLegalGrids(*(root->game)), remoteMove))
+			remoteBest = FindChild(root, remoteMove);
+		if (remoteBest != NULL)
+		{
+			best = remoteBest;
+			move = remoteMove;
+		}
+	}
+
+	if (moveCallback)
+		moveCallback(move);
+
+	if (config.logLevel != E_LOG_NONE)
+	{
+		float time = GetElapsedTime(startTime);
+
+		// depth of the principal variation
+		maxDepth = 0;
+		for (TreeNode *node = root; !node->children.empty(); ++maxDepth)
+			node = MostVisitChild(node);
+
+		SubmitSearchLog(time);
+		printf("time: %.2f, iteration: %d, depth: %d, win: %.2f%% (%d/%d)\n", time, root->visit, maxDepth, best->value * 100 / best->visit, (int)best->value, best->visit);
+		printf("fast stop count: %d, average stop steps: %d\n", fastStopCount, fastStopSteps / (fastStopCount + 1));
+		printf("stable stop count: %d, empty grids cut: %d (%.1f%% of rollout length)\n", stableStopCount, stableStopEmpties,
+			stableStopEmpties * 100.f / max(rolloutSteps + stableStopEmpties, 1));
+
+		int liveNodes = allocatedNodes - pool.size();
+		printf("nodes: %d live, %d allocated (%.1f/%d MB), %d pruned\n", liveNodes, allocatedNodes,
+			(float)allocatedNodes * TREE_NODE_BYTES / (1024 * 1024), config.memoryLimit, prunedNodes);
+		if (remote->IsActive())
+			printf("remote: %d workers alive, merged move %s\n", remote->GetAliveCount(), Game::Id2Str(move).c_str());
+		profile.Print(stdout);
+	}
 
-	maxDepth = 0;
-	PrintTree(root);
-	PrintFullTree(root);
-	printf("time: %.2f, iteration: %d, depth: %d, win: %.2f%% (%d/%d)\n", float(clock() - startTime) / 1000, root->visit, maxDepth, best->value * 100 / best->visit, (int)best->value, best->visit);
-	printf("fast stop count: %d, average stop steps: %d\n", fastStopCount, fastStopSteps / (fastStopCount + 1));
+	bool isCheckpointWritten = false;
+	if (!config.checkpointFile.empty())
+	{
+		CheckpointSnapshot snapshot;
+		MakeCheckpoint(snapshot);
+		isCheckpointWritten = WriteCheckpoint(snapshot);
+	}
 
-	ClearNodes(root);
+	if (positionCache != NULL)
+	{
+		vector<PositionCacheEntry> entries;
+		CollectCacheEntries(root, root->game->GetSide(), entries);
+		positionCache->Merge(std::move(entries)); // the local move hides std::move
+	}
 
+	TreeNode *searchRoot = root;
+	PROFILE_LOCK(treeMtx);
+	root = NULL;
+	treeMtx.unlock();
+	ClearNodes(searchRoot);
+
+	// an idle tree keeps its pool only while the process has memory to spare
+	if (scheduler.IsMemoryTight())
+		ClearPool();
+
+	// the old file stays mapped until the whole tree is written
+	checkpointMap.Close();
+	checkpointNodes = NULL;
+	checkpointNodeCount = 0;
+	if (isCheckpointWritten && !MoveFileReplace(config.checkpointFile + ".tmp", config.checkpointFile))
+		printf("checkpoint: cannot write %s\n", config.checkpointFile.c_str());
+
+	// a stop that came after the threads finished must not end the next search
+	isStopRequested = false;
 	return move;
 }
 
+// index of the highest winRate + factor * parentFactor, the first one on ties
+inline int ArgMaxScore(const ChildStats &stats, int count, float parentFactor)
+{
+#if defined(__AVX2__)
+	// lanes past count hold -1 and 0, whole vectors can be scored
+	const int VECTOR_WIDTH = 8;
+	__m256 k = _mm256_set1_ps(parentFactor);
+	__m256 scores[CHILD_NUM_MAX / VECTOR_WIDTH];
+	__m256 best = _mm256_set1_ps(-1);
+	int vectorCount = (count + VECTOR_WIDTH - 1) / VECTOR_WIDTH;
+
+	for (int v = 0; v < vectorCount; ++v)
+	{
+		__m256 w = _mm256_load_ps(&stats.winRate[v * VECTOR_WIDTH]);
+		__m256 f = _mm256_load_ps(&stats.factor[v * VECTOR_WIDTH]);
+		scores[v] = _mm256_add_ps(w, _mm256_mul_ps(f, k));
+		best = _mm256_max_ps(best, scores[v]);
+	}
+
+	best = _mm256_max_ps(best, _mm256_permute2f128_ps(best, best, 1));
+	best = _mm256_max_ps(best, _mm256_permute_ps(best, 0x4E));
+	best = _mm256_max_ps(best, _mm256_permute_ps(best, 0xB1));
+
+	for (int v = 0; v < vectorCount; ++v)
+	{
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(scores[v], best, _CMP_EQ_OQ));
+		if (mask != 0)
+			return v * VECTOR_WIDTH + BitScanForward64(mask);
+	}
+	return 0;
+#else
+	int result = 0;
+	float bestScore = -1;
+	for (int i = 0; i < count; ++i)
+	{
+		float score = stats.winRate[i] + stats.factor[i] * parentFactor;
+		if (score > bestScore)
+		{
+			bestScore = score;
+			result = i;
+		}
+	}
+	return result;
+#endif
+}
+
 TreeNode* MCTS::TreePolicy(TreeNode *node)
 {
+	PROFILE_SCOPE(E_PHASE_TREE_POLICY);
+
+	bool isNetwork = (config.evalMode == E_EVAL_NETWORK);
+
 	while (!node->game->IsGameFinish())
 	{
-		if (node->visit < EXPAND_THRESHOLD)
+		if (node->checkpoint != NULL)
+			MaterializeNode(node);
+
+		if (node->visit < config.expandThreshold || node->isPending)
 			return node;
 
 		if (PreExpandTree(node))
 			return ExpandTree(node);
 		else
-			node = BestChild(node, Cp);
+			node = BestChild(node, isNetwork ? config.cPuct : config.cUct);
 	}
 	return node;
 }
 
 bool MCTS::PreExpandTree(TreeNode *node)
 {
-	if (node->validGridCount > 0)
-	{
-		int id = rand() % node->validGridCount;
-		swap(node->validGrids[id], node->validGrids[node->validGridCount - 1]);
-	}
-	else if (node->game->state == GameBase::E_PASS && node->children.empty())
-	{
+	if (node->validGridCount == 0 && node->game->state == GameBase::E_PASS && node->children.empty())
 		node->validGrids[node->validGridCount++] = -1;
-	}
-	else
-	{
-		// try grids with lower priority after certain visits
-		if (ENABLE_TRY_MORE_NODE && node->gridLevel == 0 && node->visit > TRY_MORE_NODE_THRESHOLD * node->children.size())
-		{
-			if (node->game->UpdateValidGridsExtra())
-			{
-				node->gridLevel++;
-				node->validGrids = node->game->validGrids;
-				node->validGridCount = node->game->validGridCount;
 
-				int id = rand() % node->validGridCount;
-				swap(node->validGrids[id], node->validGrids[node->validGridCount - 1]);
-			}
-		}
+	if (node->validGridCount == 0 || node->children.size() >= CHILD_NUM_MAX)
+		return false;
+
+	if (node->children.empty() || node->game->state == GameBase::E_PASS)
+		return true;
+
+	// PUCT ranges over the grids not expanded yet as well: they have no visits,
+	// so the next one, of the highest prior, scores prior * parentFactor and is
+	// expanded only when that beats every child already in the tree
+	if (config.evalMode == E_EVAL_NETWORK)
+	{
+		int next = node->validGridCount - 1;
+		float prior = (next < (int)node->priors.size()) ? node->priors[next] : 1.f;
+		float parentFactor = CalcParentFactor(node, config.cPuct);
+		int best = ArgMaxScore(node->stats, node->children.size(), parentFactor);
+		return prior * parentFactor > node->stats.winRate[best] + node->stats.factor[best] * parentFactor;
 	}
 
-	return node->validGridCount > 0;
+	// progressive widening: the top priority grids at once, then the rest in
+	// expansion order as the visits grow, so no legal grid stays out for good
+	int widenCount = node->game->validGridCount;
+	if (ENABLE_TRY_MORE_NODE && config.tryMoreThreshold > 0)
+		widenCount += (int)sqrtf((float)node->visit / config.tryMoreThreshold);
+	return (int)node->children.size() < widenCount;
 }
 
 TreeNode* MCTS::ExpandTree(TreeNode *node)
 {
-	int move = node->validGrids[node->validGridCount - 1];
-	--(node->validGridCount);
+	PROFILE_SCOPE(E_PHASE_EXPAND_TREE);
+	PROFILE_COUNT(E_COUNTER_EXPAND, 1);
 
 	TreeNode *newNode = NewTreeNode(node);
+	if (newNode == NULL && PruneTree(node) > 0)
+		newNode = NewTreeNode(node);
+
+	if (newNode == NULL) // nothing left to prune, evaluate the node again
+		return node;
+
+	int move = node->validGrids[node->validGridCount - 1];
+	--(node->validGridCount);
+	newNode->prior = (node->validGridCount < (int)node->priors.size()) ? node->priors[node->validGridCount] : 1.f;
+	newNode->childIndex = node->children.size();
 	node->children.push_back(newNode);
+
+	// unvisited child: no win rate yet, PUCT still sees its prior
+	node->stats.winRate[newNode->childIndex] = 0;
+	node->stats.factor[newNode->childIndex] = (config.evalMode == E_EVAL_NETWORK) ? newNode->prior : 0;
 	*(newNode->game) = *(node->game);
 	newNode->game->PutChess(move);
-	newNode->validGridCount = newNode->game->validGridCount;
-	newNode->validGrids = newNode->game->validGrids;
+	SetUnexpandedGrids(newNode, CalcLegalGrids(*(newNode->game)));
+	if (positionCache != NULL)
+		SeedFromCache(newNode);
 
 	return newNode;
 }
 
-TreeNode* MCTS::BestChild(TreeNode *node, float c)
+// the child of a move, expanded when the search did not get to it; NULL without memory for it
+TreeNode* MCTS::FindChild(TreeNode *node, int move)
 {
-	TreeNode *result = NULL;
-	float bestScore = -1;
-	float expandFactorParent_c = sqrtf(logf(node->visit)) * c;
-
 	for (auto child : node->children)
 	{
-		float score = CalcScoreFast(child, expandFactorParent_c);
-		if (score > bestScore)
+		if (child->game->lastMove == move)
+			return child;
+	}
+
+	auto grids = node->validGrids.begin(), gridsEnd = grids + node->validGridCount;
+	auto it = find(grids, gridsEnd, move);
+	if (it == gridsEnd)
+		return NULL;
+
+	// moved to the back, where ExpandTree takes it from, with its prior
+	if (node->validGridCount <= (int)node->priors.size())
+		rotate(node->priors.begin() + (it - grids), node->priors.begin() + (it - grids) + 1, node->priors.begin() + node->validGridCount);
+	rotate(it, it + 1, gridsEnd);
+
+	TreeNode *child = ExpandTree(node);
+	return (child != node) ? child : NULL;
+}
+
+// grids are expanded from the back: the highest priority last, random within a priority
+void MCTS::SetUnexpandedGrids(TreeNode *node, GridMask grids)
+{
+	node->validGridCount = 0;
+	for (int priority = Board::E_PRIORITY_MAX - 1; priority >= Board::E_PRIORITY_HIGH; --priority)
+	{
+		int first = node->validGridCount;
+		for (GridMask rest = grids; !IsMaskEmpty(rest);)
 		{
-			bestScore = score;
-			result = child;
+			int id = PopMaskGrid(rest);
+			if (node->game->board.GetGridPriority(id) == priority)
+				node->validGrids[node->validGridCount++] = id;
 		}
+
+		for (int i = node->validGridCount - 1; i > first; --i)
+			swap(node->validGrids[i], node->validGrids[first + rand() % (i - first + 1)]);
 	}
-	return result;
+}
+
+TreeNode* MCTS::BestChild(TreeNode *node, float c)
+{
+	if (node->children.empty())
+		return NULL;
+
+	int index = ArgMaxScore(node->stats, node->children.size(), CalcParentFactor(node, c));
+	return node->children[index];
+}
+
+float MCTS::CalcParentFactor(const TreeNode *node, float c)
+{
+	if (config.evalMode == E_EVAL_NETWORK)
+		return sqrtf(node->visit) * c;
+
+	return sqrtf(logf(node->visit)) * c;
 }
 
 float MCTS::CalcScore(const TreeNode *node, float c, float logParentVisit)
@@ -215,61 +1064,253 @@ float MCTS::CalcScore(const TreeNode *node, float c, float logParentVisit)
 	return winRate + expandFactor;
 }
 
-float MCTS::CalcScoreFast(const TreeNode *node, float expandFactorParent_c)
-{
-	return node->winRate + node->expandFactor * expandFactorParent_c;
-}
-
 float MCTS::DefaultPolicy(TreeNode *node, int id)
 {
+	PROFILE_SCOPE(E_PHASE_DEFAULT_POLICY);
+
 	gameCache[id] = *(node->game);
+	bool isRave = IsRaveEnabled();
+	if (isRave)
+		playoutGrids[id].fill(GridMask());
+
+	PlayoutHistory *history = config.isPlayoutHistory ? playoutHistory.get() : NULL;
+	uint8_t moves[PLAYOUT_MOVE_MAX];
+	int moveCount = 0;
 
 	float weight = 1.0f;
-	while (!gameCache[id].IsGameFinish())
+	float evalWinRate = -1; // black win rate by static evaluation, -1 if the rollout is not cut
+
+	if (config.evalMode == E_EVAL_STATIC && !gameCache[id].IsGameFinish())
+		evalWinRate = Evaluator::ToWinRate(Evaluator::Evaluate(gameCache[id].board));
+
+	while (evalWinRate < 0 && !gameCache[id].IsGameFinish())
 	{
-		float factor = (1 - FAST_STOP_BRANCH_FACTOR * gameCache[id].validGridCount);
-		weight *= max(factor, 0.5f);
+		// the last grids are played perfectly, repeated tails cost a probe of the shared table
+		if (GRID_NUM - gameCache[id].board.blackCount - gameCache[id].board.whiteCount <= config.solveEmpties)
+		{
+			gameCache[id].state = EndgameSolver::SolveGame(gameCache[id]);
+			break;
+		}
+
+		if (config.evalMode == E_EVAL_ROLLOUT)
+		{
+			float factor = (1 - config.fastStopBranchFactor * gameCache[id].validGridCount);
+			weight *= max(factor, 0.5f);
+		}
+
+		int side = gameCache[id].GetSide();
+		if (config.playoutPolicy == E_PLAYOUT_SOFTMAX)
+			gameCache[id].PutPolicyChess(history);
+		else
+			gameCache[id].PutRandomChess(history);
 
-		int move = gameCache[id].PutRandomChess();
-		gameCache[id].PutChess(move);
+		if (isRave && gameCache[id].lastMove >= 0)
+			SetMaskGrid(playoutGrids[id][side], gameCache[id].lastMove);
+		if (history && moveCount < PLAYOUT_MOVE_MAX)
+			moves[moveCount++] = (gameCache[id].lastMove >= 0) ? gameCache[id].lastMove : GRID_NUM;
+
+		// more than half of the board stable decides the game, the rest of the playout is skipped
+		int stableWinner = gameCache[id].CalcStableWinner();
+		if (stableWinner != Board::E_EMPTY)
+		{
+			rolloutStats[id].stableStopCount++;
+			rolloutStats[id].stableStopEmpties += GRID_NUM - gameCache[id].board.blackCount - gameCache[id].board.whiteCount;
+			PROFILE_COUNT(E_COUNTER_STABLE_STOP, 1);
+
+			gameCache[id].state = stableWinner;
+			break;
+		}
+
+		if (config.evalMode == E_EVAL_ROLLOUT_CUT)
+		{
+			// stop once the evaluation is clear enough to trust
+			float score = Evaluator::Evaluate(gameCache[id].board);
+			if (fabsf(score) > config.evalCut)
+			{
+				rolloutStats[id].fastStopCount++;
+				rolloutStats[id].fastStopSteps += gameCache[id].turn - node->game->turn;
+				PROFILE_COUNT(E_COUNTER_FAST_STOP, 1);
+
+				evalWinRate = Evaluator::ToWinRate(score);
+			}
+			continue;
+		}
 
 		if (gameCache[id].IsOverwhelming())
 		{
 			gameCache[id].state = gameCache[id].GetSide();
 		}
 
-		if (weight < FAST_STOP_THRESHOLD)
+		if (weight < config.fastStopThreshold)
 		{
-			fastStopCount++;
-			fastStopSteps += gameCache[id].turn - node->game->turn;
+			rolloutStats[id].fastStopCount++;
+			rolloutStats[id].fastStopSteps += gameCache[id].turn - node->game->turn;
+			PROFILE_COUNT(E_COUNTER_FAST_STOP, 1);
 
 			int betterSide = gameCache[id].CalcBetterSide();
 			gameCache[id].state = betterSide; // let better side win
 		}
 	}
+	PROFILE_COUNT(E_COUNTER_PLAYOUT, 1);
+	PROFILE_COUNT(E_COUNTER_ROLLOUT_STEP, gameCache[id].turn - node->game->turn);
+	rolloutStats[id].steps += gameCache[id].turn - node->game->turn;
+
+	if (history)
+	{
+		int winner = gameCache[id].state;
+		if (evalWinRate >= 0)
+			winner = (evalWinRate > 0.5f) ? GameBase::E_BLACK_WIN : GameBase::E_WHITE_WIN;
+		history->Update(node->game->GetSide(), node->game->lastMove, moves, moveCount, winner);
+	}
+
+	if (evalWinRate >= 0)
+		return (root->game->GetSide() == Board::E_BLACK) ? evalWinRate : 1 - evalWinRate;
+
 	float value = (gameCache[id].state == root->game->GetSide()) ? 1.f : 0;
 	value = (value - 0.5f) * weight + 0.5f;
 
 	return value;
 }
 
-void MCTS::UpdateValue(TreeNode *node, float value)
+// value a virtual visit adds to a node: a loss for the side choosing it
+inline float VirtualLossValue(const TreeNode *node, int rootSide)
+{
+	return (node->game->GetSide() == rootSide) ? 1.f : 0.f;
+}
+
+void MCTS::UpdateValue(TreeNode *node, float value, bool hasVirtualLoss, int visits)
 {
+	PROFILE_SCOPE(E_PHASE_UPDATE_VALUE);
+
+	int rootSide = root->game->GetSide();
 	while (node != NULL)
 	{
-		node->visit++;
+		if (hasVirtualLoss) // one visit is already counted, replace the virtual value
+		{
+			node->value -= VirtualLossValue(node, rootSide);
+			node->virtualLosses--;
+		}
+		node->visit += hasVirtualLoss ? visits - 1 : visits;
+
 		node->value += value;
+		UpdateChildStats(node, rootSide);
 
-		node->expandFactor = sqrtf(1.f / node->visit);
-		node->winRate = node->value / node->visit;
+		node = node->parent;
+	}
+}
 
-		if (node->game->GetSide() == root->game->GetSide()) // win rate of opponent
-			node->winRate = 1 - node->winRate;
+void MCTS::AddVirtualLoss(TreeNode *node)
+{
+	int rootSide = root->game->GetSide();
+	while (node != NULL)
+	{
+		node->visit++;
+		node->value += VirtualLossValue(node, rootSide);
+		node->virtualLosses++;
+		UpdateChildStats(node, rootSide);
 
 		node = node->parent;
 	}
 }
 
+// all moves as first: a child shares the playout value when the side choosing
+// it moved to its grid anywhere later, in the tree below or in the playout
+void MCTS::UpdateRave(TreeNode *node, array<GridMask, 3> playedGrids, float value)
+{
+	PROFILE_SCOPE(E_PHASE_UPDATE_VALUE);
+
+	int rootSide = root->game->GetSide();
+	for (; node != NULL; node = node->parent)
+	{
+		const GridMask &grids = playedGrids[node->game->GetSide()];
+		for (auto child : node->children)
+		{
+			int move = child->game->lastMove;
+			if (move < 0 || !TestMaskGrid(grids, move))
+				continue;
+
+			child->raveVisit++;
+			child->raveValue += value;
+			if (child->visit > 0)
+				UpdateChildStats(child, rootSide);
+		}
+
+		if (node->parent != NULL && node->game->lastMove >= 0)
+			SetMaskGrid(playedGrids[node->parent->game->GetSide()], node->game->lastMove);
+	}
+}
+
+void MCTS::UpdateChildStats(TreeNode *node, int rootSide)
+{
+	if (node->parent == NULL)
+		return;
+
+	ChildStats &stats = node->parent->stats;
+	int i = node->childIndex;
+
+	stats.winRate[i] = node->value / node->visit;
+	if (node->raveVisit > 0 && IsRaveEnabled())
+	{
+		// the all moves as first value counts for half at raveEquivalence visits, less and less after
+		float beta = sqrtf(config.raveEquivalence / (3.f * node->visit + config.raveEquivalence));
+		stats.winRate[i] += beta * (node->raveValue / node->raveVisit - stats.winRate[i]);
+	}
+	if (node->game->GetSide() == rootSide) // win rate of opponent
+		stats.winRate[i] = 1 - stats.winRate[i];
+
+	if (config.evalMode == E_EVAL_NETWORK)
+		stats.factor[i] = node->prior / (1 + node->visit);
+	else
+		stats.factor[i] = InvSqrt(node->visit);
+}
+
+float MCTS::NetworkPolicy(TreeNode *node, array<uint8_t, GRID_NUM> &moves, array<float, GRID_NUM> &priors, int &moveCount)
+{
+	PROFILE_SCOPE(E_PHASE_DEFAULT_POLICY);
+	PROFILE_COUNT(E_COUNTER_PLAYOUT, 1);
+
+	GameBase *game = node->game;
+	int rootSide = root->game->GetSide();
+	moveCount = 0;
+
+	if (game->IsGameFinish())
+		return (game->state == rootSide) ? 1.f : 0;
+
+	NetworkInput input = Network::MakeInput(game->board, game->GetSide());
+	NetworkOutput output;
+	batcher.Evaluate(input, output);
+
+	// softmax of the legal move logits, sorted ascending so the best prior is expanded first
+	game->board.GetAllValidGrids(moves, moveCount);
+	if (moveCount > 0)
+	{
+		sort(moves.begin(), moves.begin() + moveCount, [&output](uint8_t a, uint8_t b)
+		{
+			return output.policy[a] < output.policy[b];
+		});
+
+		float maxLogit = output.policy[moves[moveCount - 1]];
+		float sum = 0;
+		for (int i = 0; i < moveCount; ++i)
+		{
+			priors[i] = expf(output.policy[moves[i]] - maxLogit);
+			sum += priors[i];
+		}
+
+		for (int i = 0; i < moveCount; ++i)
+			priors[i] /= sum;
+	}
+
+	return (game->GetSide() == rootSide) ? output.value : 1 - output.value;
+}
+
+void MCTS::ApplyPriors(TreeNode *node, const array<uint8_t, GRID_NUM> &moves, const array<float, GRID_NUM> &priors, int moveCount)
+{
+	node->validGrids = moves;
+	node->validGridCount = moveCount;
+	node->priors.assign(priors.begin(), priors.begin() + moveCount);
+}
+
 void MCTS::ClearNodes(TreeNode *node)
 {
 	if (node != NULL)
@@ -287,11 +1328,23 @@ TreeNode* MCTS::NewTreeNode(TreeNode *parent)
 {
 	if (pool.empty())
 	{
+		bool isRoot = (parent == NULL);
+		if (!isRoot && allocatedNodes >= maxNodes)
+			return NULL;
+
+		if (!SearchScheduler::Instance().ReserveNodes(1, isRoot))
+			return NULL;
+
+		PROFILE_COUNT(E_COUNTER_POOL_NEW, 1);
+		++allocatedNodes;
+
 		TreeNode *node = new TreeNode(parent);
 		node->game = new GameBase();
 		return node;
 	}
 
+	PROFILE_COUNT(E_COUNTER_POOL_REUSE, 1);
+
 	TreeNode *node = pool.back();
 	node->parent = parent;
 	pool.pop_back();
@@ -304,10 +1357,18 @@ void MCTS::RecycleTreeNode(TreeNode *node)
 	node->parent = NULL;
 	node->visit = 0;
 	node->value = 0;
-	node->winRate = 0;
-	node->expandFactor = 0;
+	node->virtualLosses = 0;
+	node->childIndex = 0;
 	node->validGridCount = 0;
-	node->gridLevel = 0;
+	node->prior = 0;
+	node->isPending = false;
+	node->checkpoint = NULL;
+	node->raveVisit = 0;
+	node->raveValue = 0;
+	node->cacheVisit = 0;
+	node->cacheValue = 0;
+	node->priors.clear();
+	node->stats.Clear(node->children.size());
 	node->children.clear();
 
 	pool.push_back(node);
@@ -320,81 +1381,407 @@ void MCTS::ClearPool()
 		delete node->game;
 		delete node;
 	}
+	SearchScheduler::Instance().ReleaseNodes(pool.size());
+	allocatedNodes -= pool.size();
+	pool.clear();
+}
+
+int MCTS::PruneTree(TreeNode *current)
+{
+	// collapse subtrees below a visit threshold, doubled until enough nodes return to the pool
+	int target = max(1, (int)(maxNodes * PRUNE_RATIO));
+	int freed = 0;
+
+	PinThreadLeaves(current, true);
+	for (int threshold = 2; freed < target && threshold <= root->visit; threshold *= 2)
+	{
+		for (auto child : root->children)
+			freed += PruneNode(child, threshold);
+	}
+	PinThreadLeaves(current, false);
+
+	prunedNodes += freed;
+	return freed;
+}
+
+int MCTS::PruneNode(TreeNode *node, int threshold)
+{
+	if (node->children.empty())
+		return 0;
+
+	if (node->visit < threshold && !node->isPinned)
+	{
+		int freed = pool.size();
+		CollapseNode(node);
+		return pool.size() - freed;
+	}
+
+	int freed = 0;
+	for (auto child : node->children)
+		freed += PruneNode(child, threshold);
+	return freed;
+}
+
+void MCTS::CollapseNode(TreeNode *node)
+{
+	// back to an unexpanded leaf, its own visit and value are kept
+	for (auto child : node->children)
+		ClearNodes(child);
+
+	node->stats.Clear(node->children.size());
+	node->children.clear();
+	node->checkpoint = NULL;
+
+	if (config.evalMode == E_EVAL_NETWORK)
+	{
+		// expansion only moved the count, the sorted grids are still in place,
+		// a node resumed from a checkpoint lacks priors of its children and gets even ones
+		array<uint8_t, GRID_NUM> moves;
+		int moveCount;
+		node->game->board.GetAllValidGrids(moves, moveCount);
+		if ((int)node->priors.size() != moveCount)
+		{
+			node->validGrids = moves;
+			node->priors.assign(moveCount, 1.f / max(moveCount, 1));
+		}
+		node->validGridCount = node->priors.size();
+	}
+	else
+	{
+		SetUnexpandedGrids(node, CalcLegalGrids(*(node->game)));
+	}
 }
 
-void MCTS::PrintTree(TreeNode *node, int level)
+void MCTS::PinThreadLeaves(TreeNode *current, bool isPinned)
 {
-	if (level == 1)
+	for (TreeNode *node = current; node != NULL; node = node->parent)
+		node->isPinned = isPinned;
+
+	for (int i = 0; i < THREAD_NUM_MAX; ++i)
 	{
-		freopen_s(&fp, LOG_FILE, "a+", stdout);
-		node->game->board.Print(node->game->lastMove);
-		fclose(stdout);
-		freopen_s(&fp, "CON", "w", stdout);
+		for (int j = 0; j < ROLLOUT_BATCH_MAX; ++j)
+		{
+			for (TreeNode *node = threadLeaves[i][j]; node != NULL; node = node->parent)
+				node->isPinned = isPinned;
+		}
+	}
+}
 
-		fopen_s(&fp, LOG_FILE, "a+");
-		fprintf(fp, "===============================PrintTree=============================\n");
-		fprintf(fp, "visit: %d, value: %.1f, children: %d\n", node->visit, node->value, node->children.size());
+void MCTS::SubmitSearchLog(float time)
+{
+	if (searchCount++ % config.logSample != 0)
+		return;
+
+	vector<char> buffer(sizeof(SearchLogHeader));
+	int nodeCount = 0;
+	if (config.logLevel >= E_LOG_TREE)
+		SnapshotTree(root, 1, buffer, nodeCount);
+
+	SearchLogHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SEARCH_LOG_MAGIC;
+	header.instance = instanceId;
+	header.searchId = searchCount - 1;
+	header.nodeCount = nodeCount;
+	for (int i = 0; i < GRID_NUM; ++i)
+		header.grids[i] = root->game->board.GetGrid(i);
+	header.lastMove = root->game->lastMove;
+	header.side = root->game->GetSide();
+	header.level = config.logLevel;
+	header.flags = profile.enabled ? E_LOG_FLAG_PROFILE : 0;
+	header.iteration = root->visit;
+	header.maxDepth = maxDepth;
+	header.fastStopCount = fastStopCount;
+	header.fastStopSteps = fastStopSteps;
+	header.time = time;
+	header.value = root->value;
+	memcpy(buffer.data(), &header, sizeof(header));
+
+	if (profile.enabled)
+	{
+		SearchLogProfile logProfile;
+		logProfile.cyclesPerSecond = profile.cyclesPerSecond;
+		memcpy(logProfile.phaseCycles, profile.total.phaseCycles, sizeof(logProfile.phaseCycles));
+		memcpy(logProfile.counters, profile.total.counters, sizeof(logProfile.counters));
+		memcpy(logProfile.lockWaitHist, profile.total.lockWaitHist, sizeof(logProfile.lockWaitHist));
+
+		size_t offset = buffer.size();
+		buffer.resize(offset + sizeof(logProfile));
+		memcpy(buffer.data() + offset, &logProfile, sizeof(logProfile));
 	}
-	
-	if (level > maxDepth)
-		maxDepth = level;
 
-	node->children.sort([](const TreeNode *a, const TreeNode *b)
+	SearchLogger::Instance().Submit(move(buffer));
+}
+
+void MCTS::SnapshotTree(TreeNode *node, int level, vector<char> &buffer, int &nodeCount)
+{
+	// sort a copy of the child list, the live tree stays untouched
+	array<TreeNode*, GRID_NUM + 1> children;
+	int childCount = 0;
+	for (auto child : node->children)
+		children[childCount++] = child;
+
+	int logCount = (config.logLevel == E_LOG_FULL) ? childCount : min(childCount, 3);
+	partial_sort(children.begin(), children.begin() + logCount, children.begin() + childCount, [](const TreeNode *a, const TreeNode *b)
 	{
 		return a->visit > b->visit;
 	});
 
-	int i = 1;
-	for (auto it = node->children.begin(); it != node->children.end(); ++it)
+	float parentFactor = CalcParentFactor(node, (config.evalMode == E_EVAL_NETWORK) ? config.cPuct : config.cUct);
+	for (int i = 0; i < logCount; ++i)
 	{
-		fprintf(fp, "%d", level);
-		for (int j = 0; j < level; ++j)
-			fprintf(fp, "   ");
+		TreeNode *child = children[i];
+
+		SearchLogNode record;
+		record.depth = level;
+		record.move = child->game->lastMove;
+		record.childCount = child->children.size();
+		record.visit = child->visit;
+		record.value = child->value;
+		record.score = node->stats.winRate[child->childIndex] + node->stats.factor[child->childIndex] * parentFactor;
+
+		size_t offset = buffer.size();
+		buffer.resize(offset + sizeof(record));
+		memcpy(buffer.data() + offset, &record, sizeof(record));
+		++nodeCount;
+
+		SnapshotTree(child, level + 1, buffer, nodeCount);
+	}
+}
+
+// a position searched in earlier games starts with a part of its visits
+void MCTS::SeedFromCache(TreeNode *node)
+{
+	int visit;
+	float winRate;
+	if (!positionCache->Find(node->game->CalcPositionKey(), visit, winRate))
+		return;
+
+	int rootSide = root->game->GetSide();
+	node->cacheVisit = min(visit, POSITION_CACHE_SEED_VISITS);
+	node->cacheValue = ((rootSide == Board::E_BLACK) ? winRate : 1 - winRate) * node->cacheVisit;
+	node->visit += node->cacheVisit;
+	node->value += node->cacheValue;
+	UpdateChildStats(node, rootSide);
+}
 
-		float expandFactorParent_c = sqrtf(logf(node->visit)) * Cp;
-		fprintf(fp, "visit: %d, value: %.1f, score: %.4f, children: %d, move: %s\n", (*it)->visit, (*it)->value, CalcScoreFast(*it, expandFactorParent_c), (*it)->children.size(), Game::Id2Str((*it)->game->lastMove).c_str());
-		PrintTree(*it, level + 1);
+// nodes of the finished search with enough visits of their own, children never have more than their parent
+void MCTS::CollectCacheEntries(const TreeNode *node, int rootSide, vector<PositionCacheEntry> &entries)
+{
+	int visit = node->visit - node->cacheVisit;
+	if (visit < POSITION_CACHE_STORE_VISITS)
+		return;
+
+	float winRate = (node->value - node->cacheValue) / visit;
+	PositionCacheEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.key = node->game->CalcPositionKey();
+	entry.visit = visit;
+	entry.winRate = (rootSide == Board::E_BLACK) ? winRate : 1 - winRate;
+	entries.push_back(entry);
 
-		if (++i > 3)
-			break;
-	}
+	for (auto child : node->children)
+		CollectCacheEntries(child, rootSide, entries);
+}
 
-	if (level == 1)
+bool MCTS::LoadCheckpoint()
+{
+	if (!checkpointMap.Open(config.checkpointFile) || checkpointMap.GetSize() < sizeof(CheckpointHeader) + sizeof(CheckpointNode))
+		return false;
+
+	// only the header is checked here, nodes are checked when they are materialized
+	const CheckpointHeader *header = (const CheckpointHeader*)checkpointMap.GetData();
+	bool isValid = header->magic == CHECKPOINT_MAGIC && header->version == CHECKPOINT_VERSION && header->evalMode == config.evalMode
+		&& header->nodeCount > 0 && checkpointMap.GetSize() == sizeof(CheckpointHeader) + header->nodeCount * sizeof(CheckpointNode)
+		&& header->turn == root->game->turn && header->state == root->game->state;
+
+	for (int i = 0; isValid && i < GRID_NUM; ++i)
+		isValid = header->grids[i] == root->game->board.GetGrid(i);
+
+	if (!isValid) // another position, the search starts over
 	{
-		fprintf(fp,"================================TreeEnd============================\n\n");
-		fclose(fp);
+		checkpointMap.Close();
+		return false;
 	}
+
+	checkpointNodes = (const CheckpointNode*)(checkpointMap.GetData() + sizeof(CheckpointHeader));
+	checkpointNodeCount = header->nodeCount;
+
+	LoadCheckpointNode(root, checkpointNodes[0]);
+	MaterializeNode(root);
+	return true;
 }
 
-void MCTS::PrintFullTree(TreeNode *node, int level)
+void MCTS::MakeCheckpoint(CheckpointSnapshot &snapshot)
 {
-	if (level == 1)
+	CheckpointHeader &header = snapshot.header;
+	memset(&header, 0, sizeof(header));
+	header.magic = CHECKPOINT_MAGIC;
+	header.version = CHECKPOINT_VERSION;
+	for (int i = 0; i < GRID_NUM; ++i)
+		header.grids[i] = root->game->board.GetGrid(i);
+	header.turn = root->game->turn;
+	header.state = root->game->state;
+	header.evalMode = config.evalMode;
+
+	// breadth first over the nodes in memory, a node not materialized yet keeps its children in the old checkpoint
+	deque<const TreeNode*> nodes;
+	nodes.push_back(root);
+	uint32_t nextIndex = 1;
+	snapshot.records.clear();
+	snapshot.sources.clear();
+
+	while (!nodes.empty())
 	{
-		fopen_s(&fp, LOG_FILE_FULL, "w");
-		fprintf(fp, "===============================PrintFullTree=============================\n");
-		fprintf(fp, "visit: %d, value: %.1f, children: %d\n", node->visit, node->value, node->children.size());
+		const TreeNode *node = nodes.front();
+		nodes.pop_front();
+
+		CheckpointNode record = MakeCheckpointNode(node);
+		const CheckpointNode *source = node->checkpoint;
+		if (source == NULL)
+		{
+			record.childCount = node->children.size();
+			record.firstChild = nextIndex;
+			nextIndex += record.childCount;
+			for (auto child : node->children)
+				nodes.push_back(child);
+		}
+		else
+		{
+			record.childCount = (source->firstChild + source->childCount <= checkpointNodeCount) ? source->childCount : 0;
+		}
+
+		snapshot.records.push_back(record);
+		snapshot.sources.push_back(source);
 	}
+}
+
+// the snapshot and the old checkpoint are merged breadth first, the mapped subtrees are read in place
+bool MCTS::WriteCheckpoint(const CheckpointSnapshot &snapshot)
+{
+	string file = config.checkpointFile + ".tmp";
+	FILE *fp;
+	if (fopen_s(&fp, file.c_str(), "wb") != 0)
+		return false;
+
+	CheckpointHeader header = snapshot.header;
+	bool isValid = fwrite(&header, sizeof(header), 1, fp) == 1;
 
-	node->children.sort([](const TreeNode *a, const TreeNode *b)
+	// a snapshot record by index, or a record of the mapped file
+	struct Item
 	{
-		return a->visit > b->visit;
-	});
+		uint32_t index;
+		const CheckpointNode *record;
+	};
+
+	deque<Item> items;
+	items.push_back({ 0, NULL });
+	uint64_t nextIndex = 1;
+	vector<CheckpointNode> chunk;
+	chunk.reserve(CHECKPOINT_WRITE_CHUNK);
+
+	while (isValid && !items.empty())
+	{
+		Item item = items.front();
+		items.pop_front();
 
-	int i = 1;
-	for (auto it = node->children.begin(); it != node->children.end(); ++it)
+		CheckpointNode record = (item.record != NULL) ? *item.record : snapshot.records[item.index];
+		const CheckpointNode *source = (item.record != NULL) ? item.record : snapshot.sources[item.index];
+
+		if (source == NULL)
+		{
+			for (int i = 0; i < record.childCount; ++i)
+				items.push_back({ record.firstChild + i, NULL });
+		}
+		else
+		{
+			record.childCount = (source->firstChild + source->childCount <= checkpointNodeCount) ? source->childCount : 0;
+			for (int i = 0; i < record.childCount; ++i)
+				items.push_back({ 0, &checkpointNodes[source->firstChild + i] });
+		}
+
+		record.firstChild = nextIndex;
+		nextIndex += record.childCount;
+
+		chunk.push_back(record);
+		if (chunk.size() == CHECKPOINT_WRITE_CHUNK || items.empty())
+		{
+			isValid = fwrite(chunk.data(), sizeof(CheckpointNode), chunk.size(), fp) == chunk.size();
+			header.nodeCount += chunk.size();
+			chunk.clear();
+		}
+	}
+
+	isValid = isValid && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+	isValid = (fclose(fp) == 0) && isValid;
+	return isValid;
+}
+
+void MCTS::MaterializeNode(TreeNode *node)
+{
+	const CheckpointNode *record = node->checkpoint;
+	node->checkpoint = NULL;
+
+	if (record->firstChild + record->childCount > checkpointNodeCount) // broken file, keep what is valid
+		return;
+
+	int rootSide = root->game->GetSide();
+	for (int i = 0; i < record->childCount; ++i)
 	{
-		fprintf(fp, "%d", level);
-		for (int j = 0; j < level; ++j)
-			fprintf(fp, "   ");
+		const CheckpointNode &childRecord = checkpointNodes[record->firstChild + i];
 
-		float expandFactorParent_c = sqrtf(logf(node->visit)) * Cp;
-		fprintf(fp, "visit: %d, value: %.1f, score: %.4f, children: %d, move: %s\n", (*it)->visit, (*it)->value, CalcScoreFast(*it, expandFactorParent_c), (*it)->children.size(), Game::Id2Str((*it)->game->lastMove).c_str());
-		PrintFullTree(*it, level + 1);
+		TreeNode *child = NewTreeNode(node);
+		if (child == NULL && PruneTree(node) > 0)
+			child = NewTreeNode(node);
+
+		if (child == NULL) // out of memory, the move is expanded again later
+		{
+			node->validGrids[node->validGridCount++] = childRecord.move;
+			continue;
+		}
+
+		child->childIndex = node->children.size();
+		node->children.push_back(child);
+		*(child->game) = *(node->game);
+		child->game->PutChess((int8_t)childRecord.move);
+		LoadCheckpointNode(child, childRecord);
+		UpdateChildStats(child, rootSide);
 	}
+}
 
-	if (level == 1)
+void MCTS::LoadCheckpointNode(TreeNode *node, const CheckpointNode &record)
+{
+	node->visit = record.visit;
+	node->value = record.value;
+	node->cacheVisit = record.cacheVisit;
+	node->cacheValue = record.cacheValue;
+	node->prior = record.prior;
+
+	SetUnexpandedGrids(node, record.validMask);
+
+	// the priors of grids not expanded yet are not saved, share the rest evenly
+	if (config.evalMode == E_EVAL_NETWORK && node->validGridCount > 0)
+		node->priors.assign(node->validGridCount, 1.f / (node->validGridCount + record.childCount));
+
+	node->checkpoint = (record.childCount > 0) ? &record : NULL;
+}
+
+CheckpointNode MCTS::MakeCheckpointNode(const TreeNode *node)
+{
+	// a periodic checkpoint sees the leaves other threads are evaluating, their virtual losses are left out
+	CheckpointNode record;
+	memset(&record, 0, sizeof(record));
+	record.visit = node->visit - node->virtualLosses;
+	record.value = node->value - node->virtualLosses * VirtualLossValue(node, root->game->GetSide());
+	record.cacheVisit = node->cacheVisit;
+	record.cacheValue = node->cacheValue;
+	record.prior = node->prior;
+	record.move = node->game->lastMove;
+
+	for (int i = 0; i < node->validGridCount; ++i)
 	{
-		fprintf(fp, "================================TreeEnd============================\n\n");
-		fclose(fp);
+		if (node->validGrids[i] < GRID_NUM) // a pending pass is added again on expansion
+			SetMaskGrid(record.validMask, node->validGrids[i]);
 	}
+	return record;
 }
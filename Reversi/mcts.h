@@ -1,9 +1,134 @@
 #pragma once
 #include <list>
+#include <vector>
 #include <ctime>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include "game.h"
+#include "searchlog.h"
+#include "eval.h"
+#include "network.h"
+#include "checkpoint.h"
+#include "poscache.h"
+#include "scheduler.h"
+#include "rollout.h"
+#include "endgame.h"
 
 const int THREAD_NUM_MAX = 32;
+// one child per empty grid at most, reachable 8x8 positions have at most 33 legal moves;
+// padded to the vector width of the score loop
+const int CHILD_NUM_MAX = (BOARD_SIZE == 8) ? 40 : (GRID_NUM - 4 + 7) / 8 * 8;
+static_assert(CHILD_NUM_MAX % 8 == 0, "CHILD_NUM_MAX must be a multiple of the vector width");
+
+typedef chrono::steady_clock::time_point TimePoint;
+
+float GetElapsedTime(TimePoint startTime);
+
+enum EvalMode
+{
+	E_EVAL_ROLLOUT,		// random playout to the end, cut by branch factor weight
+	E_EVAL_ROLLOUT_CUT,	// random playout cut by pattern evaluation
+	E_EVAL_STATIC,		// pattern evaluation of the leaf, no playout
+	E_EVAL_NETWORK,		// value/policy network for the leaf, PUCT selection
+};
+
+enum PlayoutPolicy
+{
+	E_PLAYOUT_RANDOM,	// uniform among the top priority grids
+	E_PLAYOUT_SOFTMAX,	// softmax over move features of all legal grids
+};
+
+class MCTSConfig
+{
+public:
+	MCTSConfig();
+
+	// "key=value,key=value", unknown keys are rejected
+	bool Parse(const string &text);
+	bool Set(const string &key, const string &value);
+	string ToString() const;
+
+	float searchTime;
+	int visitLimit;	// root visits ending the search before its time, 0: time only
+	int threadNum; // workers searching at once, 0: all workers of the scheduler
+	int priority;	// searches with higher priority get the workers first
+	int logLevel;	// SearchLogLevel
+	int logSample;	// log one of every logSample searches
+	int evalMode;	// EvalMode
+	float evalCut;	// disc difference to stop a rollout in E_EVAL_ROLLOUT_CUT
+	int playoutPolicy;	// PlayoutPolicy
+	float cPuct;		// exploration constant of PUCT in E_EVAL_NETWORK
+	float cUct;			// exploration constant of UCT in the other modes
+	int expandThreshold;	// visits of a leaf before its children are expanded
+	float fastStopThreshold;	// rollout weight below which the side with more discs wins
+	float fastStopBranchFactor;	// weight lost per legal grid of a rollout step
+	int tryMoreThreshold;	// visits for the first grid below the top priority, 0: top priority only
+	int networkBatch;	// leaves per network inference, 0: one per search thread
+	int rolloutBatch;	// playouts a thread runs in lockstep in E_EVAL_ROLLOUT, 1: one at a time
+	int leafPlayouts;	// most playouts of one selected leaf, backed up as one update
+	bool isLeafPlayoutAdaptive;	// fewer playouts for shallow leaves and an idle lock, else always leafPlayouts
+	int raveEquivalence;	// visits at which RAVE and UCT values weigh the same in the rollout modes, 0: off
+	bool isPlayoutHistory;	// playouts share last good replies and move win rates within a search
+	int solveEmpties;	// rollouts are solved exactly from this many empty grids, 0: off
+	int memoryLimit;	// MB of tree nodes, low visit subtrees are pruned beyond it
+	string checkpointFile;		// tree is resumed from and saved to this file, empty: off
+	float checkpointInterval;	// seconds between checkpoints of a running search
+	string positionCacheFile;	// statistics of positions kept across games, empty: off
+	int positionCacheSize;		// MB of the position cache file when it is created
+	string remoteWorkers;		// "host:port+host:port" searching the same root, empty: local only
+};
+
+// Selection statistics of the children of a node, kept contiguous so that
+// BestChild scores all of them with a few vector ops:
+// score = winRate + factor * parentFactor.
+struct ChildStats
+{
+	void Clear(int count);
+
+	alignas(32) float winRate[CHILD_NUM_MAX];	// from the side choosing the child
+	alignas(32) float factor[CHILD_NUM_MAX];	// sqrt(1 / n) for UCT, prior / (1 + n) for PUCT
+};
+
+// snapshot of a running search for progress reports
+struct SearchInfo
+{
+	float time;
+	int visit;
+	float winRate;			// of the side to move at the root
+	vector<int> pv;			// most visited line
+	vector<int> moves;		// root moves, most visited first
+	vector<int> moveVisits;
+	vector<float> moveWinRates;
+};
+
+// statistics of a node near the root, exchanged between the processes of a distributed search
+struct ShallowStat
+{
+	vector<int> path;	// moves from the root, -1: pass
+	int visit;
+	float winRate;		// of the side choosing the last move of the path
+};
+
+// rollout counters of one thread on a cache line of its own, summed when the search ends
+struct alignas(64) RolloutStats
+{
+	int fastStopCount, fastStopSteps;
+	int stableStopCount, stableStopEmpties;
+	int steps;
+};
+
+// nodes in memory copied for a checkpoint, the subtrees still in the mapped
+// old checkpoint are copied from the map when the file is written
+struct CheckpointSnapshot
+{
+	CheckpointHeader header;
+	vector<CheckpointNode> records;		// breadth first, firstChild indexes records
+	vector<const CheckpointNode*> sources;	// mapped node holding the children of a record, NULL if they are in records
+};
+
+class RemoteSearch;
 
 class TreeNode
 {
@@ -13,50 +138,148 @@ public:
 
 	int visit;
 	float value;
-	float winRate;
-	float expandFactor;
-	int validGridCount;
-	int gridLevel;
+	int virtualLosses;	// leaves in flight below, in visit and value until their backup
+	int childIndex;		// slot in the stats of the parent
+	int validGridCount;	// grids not expanded yet, the next one last
 	GameBase *game;
 
+	// E_EVAL_NETWORK only
+	float prior;			// policy of the move leading here
+	bool isPending;			// waiting for network evaluation
+	vector<float> priors;	// policy of validGrids, sorted in expansion order
+
+	// all moves as first statistics, the move leading here played later in a playout through the parent
+	int raveVisit;
+	float raveValue;
+
+	// seeded from the position cache, left out when the node is merged back
+	int cacheVisit;
+	float cacheValue;
+
+	bool isPinned;			// a search thread is working below, must not be pruned
+	const CheckpointNode *checkpoint;	// children are still in the mapped checkpoint
+
 	TreeNode *parent;
-	list<TreeNode*> children;
+	vector<TreeNode*> children;
 	array<uint8_t, GRID_NUM> validGrids;
+	ChildStats stats;	// last, leaves never touch it
 };
 
+const int TREE_NODE_BYTES = sizeof(TreeNode) + sizeof(GameBase); // child vectors are not counted
+
 class MCTS
 {
 public:
-	MCTS(int mode = 0);
+	MCTS(int mode = 0, const MCTSConfig &config = MCTSConfig());
 	~MCTS();
 	int Search(Game *state);
 
+	// thread safe, meant to be called while Search runs on another thread
+	void Stop();
+	bool GetSearchInfo(SearchInfo &info, int moveCount);
+	bool GetShallowStats(vector<ShallowStat> &stats, int depth);
+
+	const MCTSConfig& GetConfig() { return config; }
+	void SetSearchTime(float time) { config.searchTime = time; }
+	void SetMoveCallback(function<void(int)> callback) { moveCallback = callback; }	// move is known, before the tree is cleared
+	const SearchProfile& GetProfile() { return profile; }
+
 private:
-	static void SearchThread(int id, int seed, MCTS *mcts, clock_t startTime);
+	friend class SearchScheduler;
+
+	// a worker of the scheduler searches with a thread slot until the slice ends, true once the search is done
+	bool RunSlice(int slot, TimePoint sliceEnd);
+	void RunIteration(int slot);
+	void RunIterationBatch(int slot);
+	void LockTree(int slot);
+	int CalcLeafPlayouts(TreeNode *node, int slot);
 
 	// standard MCTS process
 	TreeNode* TreePolicy(TreeNode *node);
 	TreeNode* ExpandTree(TreeNode *node);
+	TreeNode* FindChild(TreeNode *node, int move);
 	TreeNode* BestChild(TreeNode *node, float c);
 	float DefaultPolicy(TreeNode *node, int id);
-	void UpdateValue(TreeNode *node, float value);
+	void UpdateValue(TreeNode *node, float value, bool hasVirtualLoss = false, int visits = 1);	// value summed over the visits
+
+	// batched network evaluation
+	void RunIterationNetwork(int slot);
+	void AddVirtualLoss(TreeNode *node);
+	float NetworkPolicy(TreeNode *node, array<uint8_t, GRID_NUM> &moves, array<float, GRID_NUM> &priors, int &moveCount);
+	void ApplyPriors(TreeNode *node, const array<uint8_t, GRID_NUM> &moves, const array<float, GRID_NUM> &priors, int moveCount);
+	bool IsSearchFinish();
+	void CheckVisitLimit();
 
 	// custom optimization
 	bool PreExpandTree(TreeNode *node);
+	void SetUnexpandedGrids(TreeNode *node, GridMask grids);
 
 	void ClearNodes(TreeNode *node);
 	float CalcScore(const TreeNode *node, float c, float logParentVisit);
-	float CalcScoreFast(const TreeNode *node, float expandFactorParent_c);
-	void PrintTree(TreeNode *node, int level = 1);
-	void PrintFullTree(TreeNode *node, int level = 1);
+	float CalcParentFactor(const TreeNode *node, float c);
+	void UpdateChildStats(TreeNode *node, int rootSide);
+	void UpdateRave(TreeNode *node, array<GridMask, 3> playedGrids, float value);
+	bool IsRaveEnabled() { return config.raveEquivalence > 0 && (config.evalMode == E_EVAL_ROLLOUT || config.evalMode == E_EVAL_ROLLOUT_CUT); }
+	void SubmitSearchLog(float time);
+	void SnapshotTree(TreeNode *node, int level, vector<char> &buffer, int &nodeCount);
 
 	TreeNode* NewTreeNode(TreeNode *parent);
 	void RecycleTreeNode(TreeNode *node);
 	void ClearPool();
-	
+
+	// memory cap
+	int PruneTree(TreeNode *current);
+	int PruneNode(TreeNode *node, int threshold);
+	void CollapseNode(TreeNode *node);
+	void PinThreadLeaves(TreeNode *current, bool isPinned);
+
+	// checkpoint
+	bool LoadCheckpoint();
+	void MakeCheckpoint(CheckpointSnapshot &snapshot);	// under the lock
+	bool WriteCheckpoint(const CheckpointSnapshot &snapshot);
+	void MaterializeNode(TreeNode *node);
+	void LoadCheckpointNode(TreeNode *node, const CheckpointNode &record);
+	CheckpointNode MakeCheckpointNode(const TreeNode *node);
+
+	// position cache
+	void SeedFromCache(TreeNode *node);
+	void CollectCacheEntries(const TreeNode *node, int rootSide, vector<PositionCacheEntry> &entries);
+
+	// distributed search
+	void CollectShallowStats(TreeNode *node, vector<int> &path, int depth, vector<ShallowStat> &stats);
+	void MergeRemoteInfo(SearchInfo &info, int moveCount);
+	int RemoteBestMove();
+
 	int maxDepth, fastStopSteps, fastStopCount;
+	int stableStopCount, stableStopEmpties, rolloutSteps;
+	int instanceId, searchCount;
 	GameBase gameCache[THREAD_NUM_MAX];
+	array<GridMask, 3> playoutGrids[THREAD_NUM_MAX];	// grids each side moved to in the last playout of a thread, by Chess
+	RolloutStats rolloutStats[THREAD_NUM_MAX];	// counted outside the lock, by slot
+	unique_ptr<PlayoutHistory> playoutHistory;	// cleared at the start of each search
 	list<TreeNode*> pool;
+	int allocatedNodes, maxNodes, prunedNodes;
+	TreeNode *threadLeaves[THREAD_NUM_MAX][ROLLOUT_BATCH_MAX];	// leaves being evaluated outside the lock
+	float threadContention[THREAD_NUM_MAX];	// share of recent lock requests that waited
+	mutex treeMtx;
+	function<void(int)> moveCallback;
+	atomic<bool> isStopRequested;
+	mutex stopMtx;
+	condition_variable stopCv;
+	TimePoint searchStartTime;
+
+	MappedFile checkpointMap;
+	const CheckpointNode *checkpointNodes;
+	uint64_t checkpointNodeCount;
+	PositionCache *positionCache;	// shared with the other searches of the process, NULL: off
 	TreeNode *root;
 	int mode;
+	MCTSConfig config;
+	NetworkBatcher batcher;
+	unique_ptr<RemoteSearch> remote;
+
+	SearchProfile profile;
+#ifdef ENABLE_PROFILE
+	ThreadProfile threadProfiles[THREAD_NUM_MAX];
+#endif
 };
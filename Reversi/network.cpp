@@ -0,0 +1,310 @@
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "network.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+const int NETWORK_BATCH_TIMEOUT_US = 200;
+
+bool Network::isLoaded = false;
+float Network::outputScale = 0;
+alignas(64) int16_t Network::weights1[NETWORK_INPUT_NUM][NETWORK_HIDDEN_NUM];
+alignas(64) int16_t Network::bias1[NETWORK_HIDDEN_NUM];
+alignas(64) int8_t Network::weights2[NETWORK_OUTPUT_NUM][NETWORK_HIDDEN_NUM];
+int32_t Network::bias2[NETWORK_OUTPUT_NUM];
+
+// network file: header, int8 weights1[input][hidden], int16 bias1[hidden],
+// int8 weights2[output][hidden], int32 bias2[output]
+struct NetworkHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t inputNum;
+	uint32_t hiddenNum;
+	uint32_t outputNum;
+	float outputScale;
+};
+
+bool Network::Load(const string &file)
+{
+	FILE *fp;
+	if (fopen_s(&fp, file.c_str(), "rb") != 0)
+		return false;
+
+	NetworkHeader header;
+	bool isValid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == NETWORK_MAGIC && header.version == NETWORK_VERSION
+		&& header.inputNum == NETWORK_INPUT_NUM && header.hiddenNum == NETWORK_HIDDEN_NUM && header.outputNum == NETWORK_OUTPUT_NUM;
+
+	static int8_t packedWeights1[NETWORK_INPUT_NUM][NETWORK_HIDDEN_NUM];
+	isValid = isValid && fread(packedWeights1, sizeof(packedWeights1), 1, fp) == 1;
+	isValid = isValid && fread(bias1, sizeof(bias1), 1, fp) == 1;
+	isValid = isValid && fread(weights2, sizeof(weights2), 1, fp) == 1;
+	isValid = isValid && fread(bias2, sizeof(bias2), 1, fp) == 1;
+	fclose(fp);
+
+	if (!isValid)
+		return false;
+
+	// layer 1 is a sum of weight rows, keep them widened to skip the conversion per add
+	for (int i = 0; i < NETWORK_INPUT_NUM; ++i)
+	{
+		for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+			weights1[i][j] = packedWeights1[i][j];
+	}
+
+	outputScale = header.outputScale;
+	isLoaded = true;
+	return true;
+}
+
+// float file: float32 weights1[input][hidden], bias1[hidden], weights2[output][hidden], bias2[output],
+// inputs as in MakeInput, outputs the policy logits by grid and the value logit last
+bool Network::Convert(const string &floatFile, const string &file)
+{
+	vector<float> w1(NETWORK_INPUT_NUM * NETWORK_HIDDEN_NUM), b1(NETWORK_HIDDEN_NUM);
+	vector<float> w2(NETWORK_OUTPUT_NUM * NETWORK_HIDDEN_NUM), b2(NETWORK_OUTPUT_NUM);
+
+	FILE *fp;
+	if (fopen_s(&fp, floatFile.c_str(), "rb") != 0)
+	{
+		printf("netconvert: cannot open %s\n", floatFile.c_str());
+		return false;
+	}
+
+	bool isValid = fread(w1.data(), sizeof(float), w1.size(), fp) == w1.size() && fread(b1.data(), sizeof(float), b1.size(), fp) == b1.size()
+		&& fread(w2.data(), sizeof(float), w2.size(), fp) == w2.size() && fread(b2.data(), sizeof(float), b2.size(), fp) == b2.size()
+		&& fgetc(fp) == EOF;
+	fclose(fp);
+
+	if (!isValid)
+	{
+		printf("netconvert: %s is not %d floats\n", floatFile.c_str(), (int)(w1.size() + b1.size() + w2.size() + b2.size()));
+		return false;
+	}
+
+	// hidden units of 127 stand for 1, layer 1 weights beyond +-1 are clipped
+	int clipCount = 0;
+	static int8_t packedWeights1[NETWORK_INPUT_NUM][NETWORK_HIDDEN_NUM];
+	for (int i = 0; i < NETWORK_INPUT_NUM; ++i)
+	{
+		for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+		{
+			float weight = roundf(w1[i * NETWORK_HIDDEN_NUM + j] * 127);
+			clipCount += fabsf(weight) > 127;
+			packedWeights1[i][j] = (int8_t)min(max(weight, -127.f), 127.f);
+		}
+	}
+
+	static int16_t packedBias1[NETWORK_HIDDEN_NUM];
+	for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+		packedBias1[j] = (int16_t)min(max(roundf(b1[j] * 127), -32767.f), 32767.f);
+
+	// layer 2 uses the whole int8 range of its largest weight, the logits are scaled back by outputScale
+	float maxWeight2 = 0;
+	for (auto weight : w2)
+		maxWeight2 = max(maxWeight2, fabsf(weight));
+	float scale2 = (maxWeight2 > 0) ? 127 / maxWeight2 : 1.f;
+
+	static int8_t packedWeights2[NETWORK_OUTPUT_NUM][NETWORK_HIDDEN_NUM];
+	static int32_t packedBias2[NETWORK_OUTPUT_NUM];
+	for (int o = 0; o < NETWORK_OUTPUT_NUM; ++o)
+	{
+		for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+			packedWeights2[o][j] = (int8_t)roundf(w2[o * NETWORK_HIDDEN_NUM + j] * scale2);
+		packedBias2[o] = (int32_t)roundf(b2[o] * 127 * scale2);
+	}
+
+	NetworkHeader header = { NETWORK_MAGIC, NETWORK_VERSION, NETWORK_INPUT_NUM, NETWORK_HIDDEN_NUM, NETWORK_OUTPUT_NUM, 1 / (127 * scale2) };
+	if (fopen_s(&fp, file.c_str(), "wb") != 0)
+	{
+		printf("netconvert: cannot write %s\n", file.c_str());
+		return false;
+	}
+
+	isValid = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(packedWeights1, sizeof(packedWeights1), 1, fp) == 1
+		&& fwrite(packedBias1, sizeof(packedBias1), 1, fp) == 1 && fwrite(packedWeights2, sizeof(packedWeights2), 1, fp) == 1
+		&& fwrite(packedBias2, sizeof(packedBias2), 1, fp) == 1;
+	isValid = (fclose(fp) == 0) && isValid;
+
+	if (clipCount > 0)
+		printf("netconvert: %d layer 1 weights clipped to +-1\n", clipCount);
+	return isValid;
+}
+
+NetworkInput Network::MakeInput(const Board &board, int side)
+{
+	NetworkInput input;
+	input.own = board.GetDiscMask(side);
+	input.opponent = board.GetDiscMask(Board::GetOtherSide(side));
+	return input;
+}
+
+void Network::CalcHidden(const NetworkInput &input, uint8_t *hidden)
+{
+#if defined(__AVX2__)
+	const int VECTOR_NUM = NETWORK_HIDDEN_NUM / 16;
+	__m256i acc[VECTOR_NUM];
+	for (int v = 0; v < VECTOR_NUM; ++v)
+		acc[v] = _mm256_load_si256((const __m256i*)&bias1[v * 16]);
+
+	for (int side = 0; side < 2; ++side)
+	{
+		GridMask mask = side == 0 ? input.own : input.opponent;
+		while (!IsMaskEmpty(mask))
+		{
+			const int16_t *row = weights1[side * GRID_NUM + PopMaskGrid(mask)];
+			for (int v = 0; v < VECTOR_NUM; ++v)
+				acc[v] = _mm256_add_epi16(acc[v], _mm256_load_si256((const __m256i*)&row[v * 16]));
+		}
+	}
+
+	// clipped relu to [0, 127] so layer 2 can use unsigned x signed byte products
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i limit = _mm256_set1_epi16(127);
+	for (int v = 0; v < VECTOR_NUM; v += 2)
+	{
+		__m256i a = _mm256_min_epi16(_mm256_max_epi16(acc[v], zero), limit);
+		__m256i b = _mm256_min_epi16(_mm256_max_epi16(acc[v + 1], zero), limit);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i*)&hidden[v * 16], packed);
+	}
+#else
+	int16_t acc[NETWORK_HIDDEN_NUM];
+	for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+		acc[j] = bias1[j];
+
+	for (int side = 0; side < 2; ++side)
+	{
+		GridMask mask = side == 0 ? input.own : input.opponent;
+		while (!IsMaskEmpty(mask))
+		{
+			const int16_t *row = weights1[side * GRID_NUM + PopMaskGrid(mask)];
+			for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+				acc[j] += row[j];
+		}
+	}
+
+	for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+		hidden[j] = (uint8_t)((acc[j] < 0) ? 0 : ((acc[j] > 127) ? 127 : acc[j]));
+#endif
+}
+
+int32_t Network::DotProduct(const uint8_t *hidden, const int8_t *weights)
+{
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+	__m256i acc = _mm256_setzero_si256();
+	for (int j = 0; j < NETWORK_HIDDEN_NUM; j += 32)
+		acc = _mm256_dpbusd_epi32(acc, _mm256_loadu_si256((const __m256i*)&hidden[j]), _mm256_load_si256((const __m256i*)&weights[j]));
+#elif defined(__AVX2__)
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i acc = _mm256_setzero_si256();
+	for (int j = 0; j < NETWORK_HIDDEN_NUM; j += 32)
+	{
+		// hidden <= 127 keeps the pairwise int16 sums of maddubs from saturating
+		__m256i products = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)&hidden[j]), _mm256_load_si256((const __m256i*)&weights[j]));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(products, ones));
+	}
+#endif
+
+#if defined(__AVX2__)
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+	return _mm_cvtsi128_si32(sum);
+#else
+	int32_t sum = 0;
+	for (int j = 0; j < NETWORK_HIDDEN_NUM; ++j)
+		sum += hidden[j] * weights[j];
+	return sum;
+#endif
+}
+
+void Network::EvaluateBatch(const NetworkInput *inputs, NetworkOutput *outputs, int count)
+{
+	alignas(64) uint8_t hidden[NETWORK_BATCH_MAX][NETWORK_HIDDEN_NUM];
+
+	for (int begin = 0; begin < count; begin += NETWORK_BATCH_MAX)
+	{
+		int batchCount = min(count - begin, NETWORK_BATCH_MAX);
+		for (int b = 0; b < batchCount; ++b)
+			CalcHidden(inputs[begin + b], hidden[b]);
+
+		// loop over outputs first, a weight row is loaded once for the whole batch
+		for (int o = 0; o < NETWORK_OUTPUT_NUM; ++o)
+		{
+			for (int b = 0; b < batchCount; ++b)
+			{
+				float logit = (bias2[o] + DotProduct(hidden[b], weights2[o])) * outputScale;
+				if (o < GRID_NUM)
+					outputs[begin + b].policy[o] = logit;
+				else
+					outputs[begin + b].value = 1.f / (1.f + expf(-logit));
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+
+NetworkBatcher::NetworkBatcher()
+{
+	batchSize = 1;
+}
+
+void NetworkBatcher::SetBatchSize(int size)
+{
+	lock_guard<mutex> lock(batchMtx);
+	batchSize = max(1, min(size, NETWORK_BATCH_MAX));
+}
+
+void NetworkBatcher::Evaluate(const NetworkInput &input, NetworkOutput &output)
+{
+	Request request = { &input, &output, false, false };
+
+	unique_lock<mutex> lock(batchMtx);
+	pending.push_back(&request);
+
+	while (!request.isDone)
+	{
+		if ((int)pending.size() >= batchSize)
+		{
+			RunBatch(lock);
+			continue;
+		}
+
+		// do not wait forever for a batch that may never fill up
+		bool isTimeout = batchCv.wait_for(lock, chrono::microseconds(NETWORK_BATCH_TIMEOUT_US)) == cv_status::timeout;
+		if (isTimeout && !request.isTaken)
+			RunBatch(lock);
+	}
+}
+
+void NetworkBatcher::RunBatch(unique_lock<mutex> &lock)
+{
+	vector<Request*> batch;
+	batch.swap(pending);
+	for (auto request : batch)
+		request->isTaken = true;
+
+	lock.unlock();
+
+	NetworkInput inputs[NETWORK_BATCH_MAX] = {};
+	NetworkOutput outputs[NETWORK_BATCH_MAX];
+	int count = batch.size();
+	for (int i = 0; i < count; ++i)
+		inputs[i] = *batch[i]->input;
+
+	Network::EvaluateBatch(inputs, outputs, count);
+
+	for (int i = 0; i < count; ++i)
+		*batch[i]->output = outputs[i];
+
+	lock.lock();
+	for (auto request : batch)
+		request->isDone = true;
+	batchCv.notify_all();
+}
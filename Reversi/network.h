@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include "game.h"
+
+const int NETWORK_INPUT_NUM = GRID_NUM * 2;		// own discs, opponent discs
+const int NETWORK_HIDDEN_NUM = 128;
+const int NETWORK_OUTPUT_NUM = GRID_NUM + 1;	// policy logits, value logit
+const int NETWORK_BATCH_MAX = 64;
+const uint32_t NETWORK_MAGIC = 0x4E4E5652; // "RVNN"
+const uint32_t NETWORK_VERSION = 1 + BOARD_FORMAT_TAG;
+const char* const NETWORK_FILE = "network.bin";
+
+// position seen from the side to move
+struct NetworkInput
+{
+	GridMask own;
+	GridMask opponent;
+};
+
+struct NetworkOutput
+{
+	float value;	// win rate of the side to move
+	array<float, GRID_NUM> policy;	// logits
+};
+
+// Small value/policy MLP with int8 weights. Layer 1 adds int16 weight rows of
+// the set input bits, layer 2 is an uint8 x int8 dot product, done with
+// AVX-512 VNNI or AVX2 when the build targets them.
+// Networks are trained outside, "reversi netconvert" quantizes the float
+// weights of a net with the same layout and a hidden relu clipped to [0, 1].
+class Network
+{
+public:
+	static bool Load(const string &file);
+	static bool Convert(const string &floatFile, const string &file);	// quantizes float weights into a network file
+	static bool IsLoaded() { return isLoaded; }
+
+	static NetworkInput MakeInput(const Board &board, int side);
+	static void EvaluateBatch(const NetworkInput *inputs, NetworkOutput *outputs, int count);
+
+private:
+	static void CalcHidden(const NetworkInput &input, uint8_t *hidden);
+	static int32_t DotProduct(const uint8_t *hidden, const int8_t *weights);
+
+	static bool isLoaded;
+	static float outputScale;
+	alignas(64) static int16_t weights1[NETWORK_INPUT_NUM][NETWORK_HIDDEN_NUM];
+	alignas(64) static int16_t bias1[NETWORK_HIDDEN_NUM];
+	alignas(64) static int8_t weights2[NETWORK_OUTPUT_NUM][NETWORK_HIDDEN_NUM];
+	static int32_t bias2[NETWORK_OUTPUT_NUM];
+};
+
+// Collects leaves of all search threads into batches, the thread that fills
+// a batch (or times out waiting) runs the inference for everyone.
+class NetworkBatcher
+{
+public:
+	NetworkBatcher();
+	void SetBatchSize(int size);
+	void Evaluate(const NetworkInput &input, NetworkOutput &output);
+
+private:
+	struct Request
+	{
+		const NetworkInput *input;
+		NetworkOutput *output;
+		bool isTaken;
+		bool isDone;
+	};
+
+	void RunBatch(unique_lock<mutex> &lock);
+
+	mutex batchMtx;
+	condition_variable batchCv;
+	vector<Request*> pending;
+	int batchSize;
+};
@@ -0,0 +1,152 @@
+#include "game.h"
+
+bool Pattern::IsReady = false;
+array<int, PATTERN_GRID_MAX + 1> Pattern::pow3;
+array<int, E_PATTERN_TYPE_MAX> Pattern::typeGridCount;
+array<int, E_PATTERN_TYPE_MAX> Pattern::typeInstanceCount;
+array<uint8_t, PATTERN_INSTANCE_NUM> Pattern::instanceType;
+array<array<uint8_t, PATTERN_GRID_MAX>, PATTERN_INSTANCE_NUM> Pattern::instanceGrids;
+array<uint8_t, GRID_NUM> Pattern::gridRefCount;
+array<array<uint8_t, PATTERN_REF_MAX>, GRID_NUM> Pattern::gridRefInstance;
+array<array<uint16_t, PATTERN_REF_MAX>, GRID_NUM> Pattern::gridRefPow3;
+
+// first instance of a pattern type as (row, col), the others are generated by symmetry
+struct PatternShape
+{
+	int count;
+	int rows[PATTERN_GRID_MAX];
+	int cols[PATTERN_GRID_MAX];
+};
+
+// Edges, lines and diagonals take up to 8 grids from a corner, the whole line on 8x8.
+// constexpr so that the number of instances is checked at compile time
+constexpr PatternShape MakeShape(int type)
+{
+	PatternShape shape = {};
+	const int length = (BOARD_SIZE < 8) ? BOARD_SIZE : 8;
+	if (type == E_PATTERN_EDGE_X || (type >= E_PATTERN_LINE_2 && type <= E_PATTERN_LINE_4))
+	{
+		int row = (type == E_PATTERN_EDGE_X) ? 0 : type - E_PATTERN_LINE_2 + 1;
+		for (int i = 0; i < length; ++i)
+		{
+			shape.rows[shape.count] = row;
+			shape.cols[shape.count++] = i;
+		}
+		if (type == E_PATTERN_EDGE_X)
+		{
+			shape.rows[shape.count] = 1;
+			shape.cols[shape.count++] = 1;
+			shape.rows[shape.count] = 1;
+			shape.cols[shape.count++] = length - 2;
+		}
+	}
+	else if (type >= E_PATTERN_DIAG_8)
+	{
+		for (int i = 0; i + type - E_PATTERN_DIAG_8 < length; ++i)
+		{
+			shape.rows[shape.count] = i;
+			shape.cols[shape.count++] = i + type - E_PATTERN_DIAG_8;
+		}
+	}
+	else
+	{
+		for (int row = 0; row < 3; ++row)
+		{
+			for (int col = 0; col < 5; ++col)
+			{
+				if ((type == E_PATTERN_CORNER_3X3 && col < 3) || (type == E_PATTERN_CORNER_2X5 && row < 2))
+				{
+					shape.rows[shape.count] = row;
+					shape.cols[shape.count++] = col;
+				}
+			}
+		}
+	}
+	return shape;
+}
+
+// grid i of the symmetric copy t: bit 0 transposes, bit 1 mirrors the rows, bit 2 the columns
+constexpr int TransformGrid(const PatternShape &shape, int i, int t)
+{
+	int row = (t & 1) ? shape.cols[i] : shape.rows[i];
+	int col = (t & 1) ? shape.rows[i] : shape.cols[i];
+	if (t & 2)
+		row = BOARD_SIZE - 1 - row;
+	if (t & 4)
+		col = BOARD_SIZE - 1 - col;
+	return row * BOARD_SIZE + col;
+}
+
+constexpr bool IsSameGridSet(const PatternShape &shape, int t1, int t2)
+{
+	uint64_t set1[2] = {}, set2[2] = {};
+	for (int i = 0; i < shape.count; ++i)
+	{
+		int id1 = TransformGrid(shape, i, t1), id2 = TransformGrid(shape, i, t2);
+		set1[id1 / 64] |= 1ULL << (id1 % 64);
+		set2[id2 / 64] |= 1ULL << (id2 % 64);
+	}
+	return set1[0] == set2[0] && set1[1] == set2[1];
+}
+
+// symmetric patterns map onto themselves, only the first copy of a grid set is an instance
+constexpr bool IsFirstCopy(const PatternShape &shape, int t)
+{
+	for (int prev = 0; prev < t; ++prev)
+	{
+		if (IsSameGridSet(shape, prev, t))
+			return false;
+	}
+	return true;
+}
+
+constexpr int CountInstances()
+{
+	int count = 0;
+	for (int type = 0; type < E_PATTERN_TYPE_MAX; ++type)
+	{
+		for (int t = 0; t < 8; ++t)
+			count += IsFirstCopy(MakeShape(type), t) ? 1 : 0;
+	}
+	return count;
+}
+
+static_assert(CountInstances() == PATTERN_INSTANCE_NUM, "PATTERN_INSTANCE_NUM must be the number of generated instances");
+
+void Pattern::Init()
+{
+	pow3[0] = 1;
+	for (int i = 1; i <= PATTERN_GRID_MAX; ++i)
+		pow3[i] = pow3[i - 1] * 3;
+
+	gridRefCount.fill(0);
+
+	int instance = 0;
+	for (int type = 0; type < E_PATTERN_TYPE_MAX; ++type)
+	{
+		PatternShape shape = MakeShape(type);
+		typeGridCount[type] = shape.count;
+		typeInstanceCount[type] = 0;
+
+		for (int t = 0; t < 8; ++t)
+		{
+			if (!IsFirstCopy(shape, t))
+				continue;
+
+			instanceType[instance] = type;
+			for (int i = 0; i < shape.count; ++i)
+			{
+				int id = TransformGrid(shape, i, t);
+				instanceGrids[instance][i] = id;
+				gridRefInstance[id][gridRefCount[id]] = instance;
+				gridRefPow3[id][gridRefCount[id]] = pow3[i];
+				++gridRefCount[id];
+			}
+
+			++typeInstanceCount[type];
+			++instance;
+		}
+	}
+
+	Pattern::IsReady = true;
+}
@@ -0,0 +1,195 @@
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+#include <map>
+#include <memory>
+#include "poscache.h"
+
+const int	POSITION_CACHE_HALF_LIFE = 2000;		// merged searches halving the worth of an untouched entry
+const int	POSITION_CACHE_VISIT_MAX = 1 << 24;	// older results keep at least a part of the weight after it
+const size_t POSITION_CACHE_QUEUE_MAX = 64;
+
+PositionCache* PositionCache::Open(const string &file, int sizeMB, int evalMode)
+{
+	static map<string, unique_ptr<PositionCache>> caches;
+	static mutex cachesMtx;
+
+	lock_guard<mutex> lock(cachesMtx);
+	auto it = caches.find(file);
+	if (it != caches.end())
+		return (it->second->header->evalMode == evalMode) ? it->second.get() : NULL;
+
+	unique_ptr<PositionCache> cache(new PositionCache());
+	if (!cache->Map(file, sizeMB, evalMode))
+		return NULL;
+
+	cache->merger = thread(MergeThread, cache.get());
+	return (caches[file] = move(cache)).get();
+}
+
+PositionCache::PositionCache()
+{
+	header = NULL;
+	entries = NULL;
+	isStopping = false;
+	isMerging = false;
+}
+
+PositionCache::~PositionCache()
+{
+	if (merger.joinable())
+	{
+		{
+			lock_guard<mutex> lock(queueMtx);
+			isStopping = true;
+		}
+		queueCv.notify_one();
+		merger.join();
+	}
+}
+
+bool PositionCache::Map(const string &file, int sizeMB, int evalMode)
+{
+	uint64_t bucketBytes = sizeof(PositionCacheEntry) * POSITION_CACHE_WAYS;
+	uint64_t bucketCount = max((uint64_t)sizeMB * 1024 * 1024 / bucketBytes, (uint64_t)1);
+	if (!this->file.OpenWritable(file, sizeof(PositionCacheHeader) + bucketCount * bucketBytes))
+	{
+		fprintf(stderr, "position cache: cannot map %s\n", file.c_str());
+		return false;
+	}
+
+	// a new file is all zeros, an existing one keeps its size
+	header = (PositionCacheHeader*)this->file.GetWritableData();
+	if (header->magic == 0)
+	{
+		header->version = POSITION_CACHE_VERSION;
+		header->evalMode = evalMode;
+		header->generation = 0;
+		header->bucketCount = bucketCount;
+		header->magic = POSITION_CACHE_MAGIC;
+	}
+
+	bool isValid = header->magic == POSITION_CACHE_MAGIC && header->version == POSITION_CACHE_VERSION && header->evalMode == evalMode
+		&& header->bucketCount > 0 && this->file.GetSize() >= sizeof(PositionCacheHeader) + header->bucketCount * bucketBytes;
+	if (!isValid)
+	{
+		fprintf(stderr, "position cache: %s is not a cache of this build and eval mode\n", file.c_str());
+		this->file.Close();
+		return false;
+	}
+
+	entries = (PositionCacheEntry*)(header + 1);
+	return true;
+}
+
+bool PositionCache::Find(uint64_t key, int &visit, float &winRate)
+{
+	shared_lock<shared_mutex> lock(entryMtx);
+	PositionCacheEntry *bucket = entries + key % header->bucketCount * POSITION_CACHE_WAYS;
+	for (int i = 0; i < POSITION_CACHE_WAYS; ++i)
+	{
+		if (bucket[i].visit > 0 && bucket[i].key == key)
+		{
+			visit = bucket[i].visit;
+			winRate = bucket[i].winRate;
+			return true;
+		}
+	}
+	return false;
+}
+
+void PositionCache::Merge(vector<PositionCacheEntry> &&entries)
+{
+	if (entries.empty())
+		return;
+
+	{
+		lock_guard<mutex> lock(queueMtx);
+		if (queue.size() >= POSITION_CACHE_QUEUE_MAX) // merging fell behind, drop the oldest search
+			queue.pop_front();
+
+		queue.push_back(move(entries));
+	}
+	queueCv.notify_one();
+}
+
+void PositionCache::Flush()
+{
+	unique_lock<mutex> lock(queueMtx);
+	flushCv.wait(lock, [this] { return queue.empty() && !isMerging; });
+}
+
+void PositionCache::MergeEntry(const PositionCacheEntry &entry)
+{
+	PositionCacheEntry *bucket = entries + entry.key % header->bucketCount * POSITION_CACHE_WAYS;
+	PositionCacheEntry *victim = NULL;
+	float victimWorth = FLT_MAX;
+
+	for (int i = 0; i < POSITION_CACHE_WAYS; ++i)
+	{
+		PositionCacheEntry &old = bucket[i];
+		if (old.visit > 0 && old.key == entry.key)
+		{
+			float visit = (float)old.visit + entry.visit;
+			old.winRate = (old.winRate * old.visit + entry.winRate * entry.visit) / visit;
+			old.visit = (int)min(visit, (float)POSITION_CACHE_VISIT_MAX);
+			old.generation = header->generation;
+			return;
+		}
+
+		float worth = CalcWorth(old);
+		if (worth < victimWorth)
+		{
+			victim = &old;
+			victimWorth = worth;
+		}
+	}
+
+	// a position seen once does not push out one that kept coming back
+	if (entry.visit >= victimWorth)
+	{
+		*victim = entry;
+		victim->generation = header->generation;
+	}
+}
+
+float PositionCache::CalcWorth(const PositionCacheEntry &entry)
+{
+	if (entry.visit == 0)
+		return 0;
+
+	uint32_t age = header->generation - entry.generation;
+	return entry.visit * exp2f(-(float)age / POSITION_CACHE_HALF_LIFE);
+}
+
+void PositionCache::MergeThread(PositionCache *cache)
+{
+	unique_lock<mutex> lock(cache->queueMtx);
+	while (1)
+	{
+		cache->queueCv.wait(lock, [cache] { return cache->isStopping || !cache->queue.empty(); });
+
+		if (cache->queue.empty())
+		{
+			if (cache->isStopping)
+				break;
+			continue;
+		}
+
+		vector<PositionCacheEntry> entries = move(cache->queue.front());
+		cache->queue.pop_front();
+		cache->isMerging = true;
+		lock.unlock();
+
+		{
+			unique_lock<shared_mutex> entryLock(cache->entryMtx);
+			cache->header->generation++;
+			for (auto &entry : entries)
+				cache->MergeEntry(entry);
+		}
+
+		lock.lock();
+		cache->isMerging = false;
+		cache->flushCv.notify_all();
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include "game.h"
+#include "checkpoint.h"
+
+using namespace std;
+
+const uint32_t POSITION_CACHE_MAGIC = 0x43505652; // "RVPC"
+const uint32_t POSITION_CACHE_VERSION = 1 + BOARD_FORMAT_TAG;
+const int POSITION_CACHE_WAYS = 4;	// entries of a bucket
+
+#pragma pack(push, 1)
+struct PositionCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	int32_t evalMode;		// values of different eval modes do not mix
+	uint32_t generation;	// searches merged so far, entries age by it
+	uint64_t bucketCount;	// POSITION_CACHE_WAYS entries each follow the header
+};
+
+struct PositionCacheEntry
+{
+	uint64_t key;			// GameBase::CalcPositionKey
+	int32_t visit;			// 0: empty
+	float winRate;			// of black
+	uint32_t generation;	// of the last merge into the entry
+	uint32_t reserved;
+};
+#pragma pack(pop)
+
+// Search statistics of positions across games and runs, in a file
+// mapped read-write and shared by every search of the process naming it.
+// New tree nodes are seeded from it, finished searches queue their well
+// visited nodes and a background thread merges them in. The file size is fixed
+// when it is created, a full bucket evicts the entry of the fewest aged visits.
+// Only one process should write a file at a time.
+class PositionCache
+{
+public:
+	// the cache of file shared by the process, NULL if it cannot be mapped or belongs to another eval mode
+	static PositionCache* Open(const string &file, int sizeMB, int evalMode);
+	~PositionCache();
+
+	bool Find(uint64_t key, int &visit, float &winRate);	// thread safe
+	void Merge(vector<PositionCacheEntry> &&entries);	// queued, never blocks the search
+	void Flush();
+
+private:
+	PositionCache();
+	bool Map(const string &file, int sizeMB, int evalMode);
+	void MergeEntry(const PositionCacheEntry &entry);
+	float CalcWorth(const PositionCacheEntry &entry);
+	static void MergeThread(PositionCache *cache);
+
+	MappedFile file;
+	PositionCacheHeader *header;
+	PositionCacheEntry *entries;
+	shared_mutex entryMtx;
+
+	deque<vector<PositionCacheEntry>> queue;
+	mutex queueMtx;
+	condition_variable queueCv, flushCv;
+	thread merger;
+	bool isStopping;
+	bool isMerging;
+};
@@ -0,0 +1,85 @@
+#include <cstring>
+#include "profiler.h"
+
+#ifdef ENABLE_PROFILE
+thread_local ThreadProfile *threadProfile = NULL;
+#endif
+
+void ThreadProfile::Clear()
+{
+	memset(phaseCycles, 0, sizeof(phaseCycles));
+	memset(counters, 0, sizeof(counters));
+	memset(lockWaitHist, 0, sizeof(lockWaitHist));
+}
+
+///////////////////////////////////////////////////////////////////////
+
+SearchProfile::SearchProfile()
+{
+	Clear();
+}
+
+void SearchProfile::Clear()
+{
+#ifdef ENABLE_PROFILE
+	enabled = true;
+#else
+	enabled = false;
+#endif
+	cyclesPerSecond = 0;
+	total.Clear();
+}
+
+void SearchProfile::Merge(const ThreadProfile &profile)
+{
+	for (int i = 0; i < E_PHASE_MAX; ++i)
+		total.phaseCycles[i] += profile.phaseCycles[i];
+
+	for (int i = 0; i < E_COUNTER_MAX; ++i)
+		total.counters[i] += profile.counters[i];
+
+	for (int i = 0; i < LOCK_WAIT_BUCKET_NUM; ++i)
+		total.lockWaitHist[i] += profile.lockWaitHist[i];
+}
+
+void SearchProfile::Print(FILE *out) const
+{
+	if (!enabled)
+		return;
+
+	const char *phaseText[] = { "tree policy", "expand tree", "default policy", "update value", "lock wait" };
+
+	// expand tree is timed inside tree policy
+	uint64_t phaseCycles[E_PHASE_MAX];
+	memcpy(phaseCycles, total.phaseCycles, sizeof(phaseCycles));
+	phaseCycles[E_PHASE_TREE_POLICY] -= phaseCycles[E_PHASE_EXPAND_TREE];
+
+	uint64_t allCycles = 0;
+	for (int i = 0; i < E_PHASE_MAX; ++i)
+		allCycles += phaseCycles[i];
+
+	fprintf(out, "profile (thread time):");
+	for (int i = 0; i < E_PHASE_MAX; ++i)
+	{
+		double ms = (cyclesPerSecond > 0) ? phaseCycles[i] * 1000 / cyclesPerSecond : 0;
+		fprintf(out, " %s %.1fms (%.1f%%)%s", phaseText[i], ms, phaseCycles[i] * 100.0 / (allCycles + 1), (i + 1 < E_PHASE_MAX) ? "," : "\n");
+	}
+
+	uint64_t playouts = total.counters[E_COUNTER_PLAYOUT];
+	fprintf(out, "profile: playouts %llu, avg rollout %.1f, fast stop %llu, stable stop %llu, expand %llu, pool reuse %llu/%llu\n",
+		(unsigned long long)playouts,
+		total.counters[E_COUNTER_ROLLOUT_STEP] / (double)(playouts + 1),
+		(unsigned long long)total.counters[E_COUNTER_FAST_STOP],
+		(unsigned long long)total.counters[E_COUNTER_STABLE_STOP],
+		(unsigned long long)total.counters[E_COUNTER_EXPAND],
+		(unsigned long long)total.counters[E_COUNTER_POOL_REUSE],
+		(unsigned long long)(total.counters[E_COUNTER_POOL_REUSE] + total.counters[E_COUNTER_POOL_NEW]));
+
+	fprintf(out, "profile: lock waits %llu, cycles histogram (log2):", (unsigned long long)total.counters[E_COUNTER_LOCK]);
+	for (int i = 0; i < LOCK_WAIT_BUCKET_NUM; ++i)
+	{
+		if (total.lockWaitHist[i] > 0)
+			fprintf(out, " [%d]%llu", i, (unsigned long long)total.lockWaitHist[i]);
+	}
+	fprintf(out, "\n");
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// Search instrumentation is only compiled into profile and debug builds,
+// define MCTS_PROFILE to enable it in an optimized build.
+#if defined(MCTS_PROFILE) || defined(_DEBUG)
+#define ENABLE_PROFILE
+#endif
+
+enum ProfilePhase
+{
+	E_PHASE_TREE_POLICY,
+	E_PHASE_EXPAND_TREE,
+	E_PHASE_DEFAULT_POLICY,
+	E_PHASE_UPDATE_VALUE,
+	E_PHASE_LOCK_WAIT,
+	E_PHASE_MAX,
+};
+
+enum ProfileCounter
+{
+	E_COUNTER_PLAYOUT,
+	E_COUNTER_ROLLOUT_STEP,
+	E_COUNTER_FAST_STOP,
+	E_COUNTER_STABLE_STOP,
+	E_COUNTER_EXPAND,
+	E_COUNTER_POOL_REUSE,
+	E_COUNTER_POOL_NEW,
+	E_COUNTER_LOCK,
+	E_COUNTER_MAX,
+};
+
+// bucket i counts lock waits of [2^i, 2^(i+1)) cycles
+const int LOCK_WAIT_BUCKET_NUM = 24;
+
+struct alignas(64) ThreadProfile
+{
+	void Clear();
+
+	uint64_t phaseCycles[E_PHASE_MAX];
+	uint64_t counters[E_COUNTER_MAX];
+	uint64_t lockWaitHist[LOCK_WAIT_BUCKET_NUM];
+};
+
+class SearchProfile
+{
+public:
+	SearchProfile();
+	void Clear();
+	void Merge(const ThreadProfile &profile);
+	void Print(FILE *out) const;
+
+	bool enabled;		// false if instrumentation is compiled out
+	double cyclesPerSecond;
+	ThreadProfile total;
+};
+
+#ifdef ENABLE_PROFILE
+
+// profile of the calling search thread, NULL outside of a search
+extern thread_local ThreadProfile *threadProfile;
+
+class ProfileScope
+{
+public:
+	ProfileScope(ProfilePhase phase)
+	{
+		this->phase = phase;
+		startCycle = __rdtsc();
+	}
+
+	~ProfileScope()
+	{
+		if (threadProfile != NULL)
+			threadProfile->phaseCycles[phase] += __rdtsc() - startCycle;
+	}
+
+private:
+	ProfilePhase phase;
+	uint64_t startCycle;
+};
+
+inline void ProfileLock(mutex &mtx)
+{
+	uint64_t startCycle = __rdtsc();
+	mtx.lock();
+	uint64_t cycles = __rdtsc() - startCycle;
+
+	if (threadProfile != NULL)
+	{
+		int bucket = 0;
+		while (bucket < LOCK_WAIT_BUCKET_NUM - 1 && (cycles >> (bucket + 1)) != 0)
+			++bucket;
+
+		threadProfile->phaseCycles[E_PHASE_LOCK_WAIT] += cycles;
+		threadProfile->counters[E_COUNTER_LOCK]++;
+		threadProfile->lockWaitHist[bucket]++;
+	}
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(phase)
+#define PROFILE_COUNT(counter, n) do { if (threadProfile != NULL) threadProfile->counters[counter] += (n); } while (0)
+#define PROFILE_LOCK(mtx) ProfileLock(mtx)
+
+#else
+
+#define PROFILE_SCOPE(phase) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_LOCK(mtx) (mtx).lock()
+
+#endif
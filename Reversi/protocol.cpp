@@ -0,0 +1,398 @@
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include "protocol.h"
+
+const float	INFO_INTERVAL = 1.f;
+const int	INFO_MOVE_NUM = 5;			// root moves listed per info line
+const float	TIME_SAFETY = 0.9f;			// part of the allocated time actually used
+const float	TIME_MIN = 0.01f;
+const int	TIME_MOVES_MARGIN = 2;		// moves added to the expected count left
+
+const char* const PROTOCOL_COMMANDS[] =
+{
+	"protocol_version", "name", "version", "known_command", "list_commands", "quit",
+	"boardsize", "clear_board", "play", "genmove", "undo", "showboard",
+	"time_settings", "time_left", "set_option", "info_interval", "stop",
+};
+
+ProtocolEngine::ProtocolEngine(const MCTSConfig &config)
+{
+	this->config = config;
+	ai.reset(new MCTS(0, config));
+	ai->SetMoveCallback([this](int move) { OnSearchMove(move); });
+
+	isSearching = false;
+	isMoveSent = false;
+	searchId = -1;
+	searchSide = Board::E_BLACK;
+	infoInterval = INFO_INTERVAL;
+
+	hasClock = false;
+	mainTime = 0;
+	byoyomiTime = 0;
+	byoyomiStones = 0;
+	ResetClock();
+}
+
+ProtocolEngine::~ProtocolEngine()
+{
+	{
+		lock_guard<mutex> lock(infoMtx);
+		if (isSearching && !isMoveSent)
+			ai->Stop();
+	}
+	WaitSearch();
+}
+
+void ProtocolEngine::Run(istream &in)
+{
+	string line;
+	while (getline(in, line))
+	{
+		if (!Execute(line))
+			break;
+	}
+}
+
+bool ProtocolEngine::Execute(const string &line)
+{
+	string text = line.substr(0, line.find('#'));
+	replace_if(text.begin(), text.end(), [](char c) { return iscntrl((unsigned char)c) != 0; }, ' ');
+
+	stringstream ss(text);
+	string command;
+	int id = -1;
+	if (!(ss >> command))
+		return true;
+
+	if (isdigit((unsigned char)command[0]))
+	{
+		id = stoi(command);
+		if (!(ss >> command))
+			return true;
+	}
+	transform(command.begin(), command.end(), command.begin(), ::tolower);
+
+	// only these are served while a search runs, everything else waits for it in order
+	if (command == "stop" || command == "quit")
+	{
+		lock_guard<mutex> lock(infoMtx);
+		if (isSearching && !isMoveSent)
+			ai->Stop();
+	}
+
+	if (command == "stop")
+	{
+		Respond(id, true, "");
+		return true;
+	}
+
+	if (command == "quit")
+	{
+		WaitSearch();
+		Respond(id, true, "");
+		return false;
+	}
+
+	WaitSearch();
+
+	if (command == "protocol_version")
+	{
+		Respond(id, true, "2");
+	}
+	else if (command == "name")
+	{
+		Respond(id, true, "Reversi MCTS");
+	}
+	else if (command == "version")
+	{
+		Respond(id, true, "1.0");
+	}
+	else if (command == "known_command")
+	{
+		string name;
+		ss >> name;
+		bool isKnown = find(begin(PROTOCOL_COMMANDS), end(PROTOCOL_COMMANDS), name) != end(PROTOCOL_COMMANDS);
+		Respond(id, true, isKnown ? "true" : "false");
+	}
+	else if (command == "list_commands")
+	{
+		string result;
+		for (auto name : PROTOCOL_COMMANDS)
+			result += string(result.empty() ? "" : "\n") + name;
+		Respond(id, true, result);
+	}
+	else if (command == "boardsize")
+	{
+		int size = 0;
+		ss >> size;
+		Respond(id, size == BOARD_SIZE, (size == BOARD_SIZE) ? "" : "unacceptable size");
+	}
+	else if (command == "clear_board")
+	{
+		game.Reset();
+		ResetClock();
+		Respond(id, true, "");
+	}
+	else if (command == "play")
+	{
+		string color, moveText;
+		ss >> color >> moveText;
+		transform(moveText.begin(), moveText.end(), moveText.begin(), ::toupper);
+
+		int side = ParseColor(color);
+		int grid = Game::Str2Id(moveText);
+		int move = (moveText == "PASS") ? -1 : ((grid >= 0) ? grid : -2);
+		bool isPassValid = (move == -1) && game.GetState() == GameBase::E_PASS;
+		bool isValid = side == game.GetSide() && !game.IsGameFinish() && (isPassValid || (move >= 0 && game.GetState() == GameBase::E_NORMAL));
+
+		if (isValid && game.PutChess(move))
+			Respond(id, true, "");
+		else
+			Respond(id, false, "illegal move");
+	}
+	else if (command == "genmove")
+	{
+		string color;
+		ss >> color;
+		int side = ParseColor(color);
+
+		if (side != game.GetSide())
+			Respond(id, false, "not this color's turn");
+		else if (game.IsGameFinish())
+			Respond(id, true, "pass");
+		else
+			StartSearch(id);
+	}
+	else if (command == "undo")
+	{
+		bool canUndo = !game.GetRecord().empty();
+		if (canUndo)
+			game.Regret(1);
+		Respond(id, canUndo, canUndo ? "" : "cannot undo");
+	}
+	else if (command == "showboard")
+	{
+		lock_guard<mutex> lock(outputMtx);
+		printf("=%s\n", (id >= 0) ? to_string(id).c_str() : "");
+		game.Print();
+		printf("\n");
+		fflush(stdout);
+	}
+	else if (command == "time_settings")
+	{
+		float main = -1, byoyomi = -1;
+		int stones = -1;
+		ss >> main >> byoyomi >> stones;
+
+		bool isValid = main >= 0 && byoyomi >= 0 && stones >= 0;
+		if (isValid)
+		{
+			mainTime = main;
+			byoyomiTime = byoyomi;
+			byoyomiStones = stones;
+			hasClock = mainTime > 0 || byoyomiTime > 0;
+			ResetClock();
+		}
+		Respond(id, isValid, isValid ? "" : "syntax error");
+	}
+	else if (command == "time_left")
+	{
+		string color;
+		float time = -1;
+		int stones = -1;
+		ss >> color >> time >> stones;
+
+		int side = ParseColor(color);
+		bool isValid = side != Board::E_EMPTY && time >= 0 && stones >= 0;
+		if (isValid)
+		{
+			hasClock = true;
+			timeLeft[side] = time;
+			stonesLeft[side] = stones;
+		}
+		Respond(id, isValid, isValid ? "" : "syntax error");
+	}
+	else if (command == "set_option")
+	{
+		// same "key=value,..." text as the command line
+		string options;
+		getline(ss, options);
+		options.erase(remove(options.begin(), options.end(), ' '), options.end());
+
+		MCTSConfig newConfig = config;
+		bool isValid = newConfig.Parse(options);
+		if (isValid)
+		{
+			config = newConfig;
+			ai.reset(new MCTS(0, config));
+			ai->SetMoveCallback([this](int move) { OnSearchMove(move); });
+		}
+		Respond(id, isValid, isValid ? config.ToString() : "invalid option");
+	}
+	else if (command == "info_interval")
+	{
+		float interval = -1;
+		ss >> interval;
+		if (interval >= 0)
+			infoInterval = interval;
+		Respond(id, interval >= 0, (interval >= 0) ? "" : "syntax error");
+	}
+	else
+	{
+		Respond(id, false, "unknown command");
+	}
+	return true;
+}
+
+void ProtocolEngine::Respond(int id, bool isSuccess, const string &text)
+{
+	lock_guard<mutex> lock(outputMtx);
+	string idText = (id >= 0) ? to_string(id) : "";
+	printf("%c%s%s%s\n\n", isSuccess ? '=' : '?', idText.c_str(), text.empty() ? "" : " ", text.c_str());
+	fflush(stdout);
+}
+
+void ProtocolEngine::StartSearch(int id)
+{
+	searchId = id;
+	searchSide = game.GetSide();
+	ai->SetSearchTime(AllocateTime(searchSide));
+	searchStartTime = chrono::steady_clock::now();
+
+	isSearching = true;
+	isMoveSent = false;
+	searchThread = thread(SearchThread, this);
+	if (infoInterval > 0)
+		infoThread = thread(InfoThread, this);
+}
+
+void ProtocolEngine::WaitSearch()
+{
+	if (searchThread.joinable())
+		searchThread.join();
+	if (infoThread.joinable())
+		infoThread.join();
+}
+
+void ProtocolEngine::SearchThread(ProtocolEngine *engine)
+{
+	engine->ai->Search(&engine->game);
+
+	lock_guard<mutex> lock(engine->infoMtx);
+	engine->isSearching = false;
+	engine->infoCv.notify_all();
+}
+
+void ProtocolEngine::OnSearchMove(int move)
+{
+	// called by Search as soon as the move is known, the tree is cleared after the answer
+	{
+		lock_guard<mutex> lock(infoMtx);
+		isMoveSent = true;
+	}
+
+	UpdateClock(searchSide, GetElapsedTime(searchStartTime));
+	game.PutChess(move);
+	Respond(searchId, true, Game::Id2Str(move));
+}
+
+void ProtocolEngine::InfoThread(ProtocolEngine *engine)
+{
+	unique_lock<mutex> lock(engine->infoMtx);
+	while (!engine->infoCv.wait_for(lock, chrono::duration<float>(engine->infoInterval), [engine] { return !engine->isSearching; }))
+	{
+		SearchInfo info;
+		if (!engine->ai->GetSearchInfo(info, INFO_MOVE_NUM))
+			continue;
+
+		string text = FormatInfo(info);
+		fprintf(stderr, "%s\n", text.c_str());
+		fflush(stderr);
+	}
+}
+
+void ProtocolEngine::ResetClock()
+{
+	for (int side = 0; side < 3; ++side)
+	{
+		timeLeft[side] = mainTime;
+		stonesLeft[side] = 0;
+	}
+
+	if (mainTime <= 0 && byoyomiTime > 0)
+	{
+		for (int side = 0; side < 3; ++side)
+		{
+			timeLeft[side] = byoyomiTime;
+			stonesLeft[side] = byoyomiStones;
+		}
+	}
+}
+
+float ProtocolEngine::AllocateTime(int side)
+{
+	if (!hasClock)
+		return config.searchTime;
+
+	// in byo-yomi the period is shared by its stones, otherwise by the moves expected to be left
+	int moveNum = (stonesLeft[side] > 0) ? stonesLeft[side] : (game.GetEmptyCount() + 1) / 2 + TIME_MOVES_MARGIN;
+	float time = timeLeft[side] / max(moveNum, 1);
+
+	if (stonesLeft[side] == 0 && byoyomiStones > 0) // main time, the byo-yomi is still to come
+		time += byoyomiTime / byoyomiStones;
+
+	return max(time * TIME_SAFETY, TIME_MIN);
+}
+
+void ProtocolEngine::UpdateClock(int side, float usedTime)
+{
+	if (!hasClock)
+		return;
+
+	// a manager sending time_left overrides this estimate before the next move
+	timeLeft[side] -= usedTime;
+	if (stonesLeft[side] > 0 && --stonesLeft[side] == 0)
+	{
+		timeLeft[side] = byoyomiTime;
+		stonesLeft[side] = byoyomiStones;
+	}
+	else if (stonesLeft[side] == 0 && timeLeft[side] <= 0 && byoyomiStones > 0)
+	{
+		timeLeft[side] = byoyomiTime;
+		stonesLeft[side] = byoyomiStones;
+	}
+	timeLeft[side] = max(timeLeft[side], 0.f);
+}
+
+int ProtocolEngine::ParseColor(const string &text)
+{
+	string color = text;
+	transform(color.begin(), color.end(), color.begin(), ::tolower);
+
+	if (color == "b" || color == "black")
+		return Board::E_BLACK;
+	if (color == "w" || color == "white")
+		return Board::E_WHITE;
+	return Board::E_EMPTY;
+}
+
+string ProtocolEngine::FormatInfo(const SearchInfo &info)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "info time %.2f visits %d winrate %.1f pv", info.time, info.visit, info.winRate * 100);
+	string text = buffer;
+
+	for (auto move : info.pv)
+		text += " " + Game::Id2Str(move);
+
+	text += " moves";
+	for (size_t i = 0; i < info.moves.size(); ++i)
+	{
+		snprintf(buffer, sizeof(buffer), " %s:%d:%.1f", Game::Id2Str(info.moves[i]).c_str(), info.moveVisits[i], info.moveWinRates[i] * 100);
+		text += buffer;
+	}
+	return text;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include "mcts.h"
+
+// Headless front end speaking a GTP style text protocol on stdin/stdout:
+// "[id] command args" is answered by "=[id] result" or "?[id] error" and an
+// empty line. genmove searches on its own thread, so stop and quit are served
+// while it runs. Progress lines "info ..." go to stderr every info interval.
+class ProtocolEngine
+{
+public:
+	ProtocolEngine(const MCTSConfig &config);
+	~ProtocolEngine();
+
+	void Run(istream &in);
+
+private:
+	bool Execute(const string &line);	// false on quit
+	void Respond(int id, bool isSuccess, const string &text);
+
+	void StartSearch(int id);
+	void WaitSearch();
+	void OnSearchMove(int move);
+	static void SearchThread(ProtocolEngine *engine);
+	static void InfoThread(ProtocolEngine *engine);
+
+	void ResetClock();
+	float AllocateTime(int side);
+	void UpdateClock(int side, float usedTime);
+
+	static int ParseColor(const string &text);
+	static string FormatInfo(const SearchInfo &info);
+
+	MCTSConfig config;
+	unique_ptr<MCTS> ai;
+	Game game;
+
+	thread searchThread, infoThread;
+	atomic<bool> isSearching;
+	bool isMoveSent;		// stop is ignored once the answer is out
+	int searchId;
+	int searchSide;
+	TimePoint searchStartTime;
+	float infoInterval;		// seconds between info lines, 0: off
+
+	mutex outputMtx;
+	mutex infoMtx;			// guards the end of a search, wakes the info thread
+	condition_variable infoCv;
+
+	// time control of time_settings / time_left, indexed by side
+	bool hasClock;
+	float mainTime, byoyomiTime;
+	int byoyomiStones;
+	float timeLeft[3];
+	int stonesLeft[3];		// 0: main time, otherwise moves left in the byo-yomi period
+};
@@ -0,0 +1,351 @@
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include "rollout.h"
+#include "endgame.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+array<array<GridMask, Board::E_PRIORITY_MAX>, GRID_PRIORITY_DICT_NUM> RolloutBatch::priorityMasks;
+array<int, 4> RolloutBatch::cornerGrids;
+GridMask RolloutBatch::allMask, RolloutBatch::cornerMask, RolloutBatch::edgeMask;
+array<array<GridMask, 2>, GRID_NUM> RolloutBatch::edgeRuns;
+
+void RolloutBatch::Init()
+{
+	// worker sessions construct their MCTS on their own threads
+	static once_flag once;
+	call_once(once, InitTables);
+}
+
+void RolloutBatch::InitTables()
+{
+	Board board; // builds the priority dict
+
+	const int last = BOARD_SIZE - 1;
+	cornerGrids = { Board::Coord2Id(0, 0), Board::Coord2Id(last, 0), Board::Coord2Id(0, last), Board::Coord2Id(last, last) };
+	allMask = cornerMask = edgeMask = GridMask();
+	for (int id = 0; id < GRID_NUM; ++id)
+		SetMaskGrid(allMask, id);
+	for (auto id : cornerGrids)
+		SetMaskGrid(cornerMask, id);
+
+	for (int key = 0; key < GRID_PRIORITY_DICT_NUM; ++key)
+	{
+		priorityMasks[key].fill(GridMask());
+		for (int id = 0; id < GRID_NUM; ++id)
+			SetMaskGrid(priorityMasks[key][Board::GetGridPriority(key, id)], id);
+	}
+
+	// same walk as Board::CalcMoveFeatures, along the edge in both directions
+	for (int id = 0; id < GRID_NUM; ++id)
+	{
+		int row, col;
+		Board::Id2Coord(id, row, col);
+		edgeRuns[id].fill(GridMask());
+
+		bool isRowEdge = (row == 0 || row == last);
+		bool isColEdge = (col == 0 || col == last);
+		if (isRowEdge == isColEdge)
+			continue;
+
+		SetMaskGrid(edgeMask, id);
+		for (int i = 0; i < BOARD_SIZE; ++i)
+		{
+			int id1 = isRowEdge ? Board::Coord2Id(row, i) : Board::Coord2Id(i, col);
+			int pos = isRowEdge ? col : row;
+			if (i < pos)
+				SetMaskGrid(edgeRuns[id][0], id1);
+			else if (i > pos)
+				SetMaskGrid(edgeRuns[id][1], id1);
+		}
+	}
+}
+
+RolloutBatch::RolloutBatch(bool isPolicyPlayout, float fastStopThreshold, float branchFactor, int solveEmpties, PlayoutHistory *history)
+{
+	this->isPolicyPlayout = isPolicyPlayout;
+	this->history = history;
+	this->fastStopThreshold = fastStopThreshold;
+	this->branchFactor = branchFactor;
+	this->solveEmpties = solveEmpties;
+	count = 0;
+
+	// lanes past count are empty boards, they are carried through the vector passes
+	for (int i = 0; i < ROLLOUT_BATCH_MAX; ++i)
+	{
+		own[i] = other[i] = moves[i] = GridMask();
+		state[i] = GameBase::E_DRAW;
+	}
+}
+
+int RolloutBatch::Add(GameBase &game)
+{
+	int lane = count++;
+	int side = game.GetSide();
+	own[lane] = game.board.GetDiscMask(side);
+	other[lane] = game.board.GetDiscMask(Board::GetOtherSide(side));
+	moves[lane] = BitBoard<BOARD_SIZE>::CalcMoves(own[lane], other[lane]);
+
+	state[lane] = game.state;
+	turn[lane] = startTurn[lane] = game.turn;
+	lastBlackCount[lane] = game.lastBlackCount;
+	lastWhiteCount[lane] = game.lastWhiteCount;
+	weight[lane] = 1.f;
+	isFastStop[lane] = isStableStop[lane] = false;
+	playedGrids[lane][0] = playedGrids[lane][1] = GridMask();
+	lastMove[lane] = startLastMove[lane] = game.lastMove;
+	startSide[lane] = side;
+	return lane;
+}
+
+#if defined(__AVX2__) && REVERSI_BOARD_SIZE <= 8
+template<int n>
+inline __m256i StepVector(__m256i mask)
+{
+	constexpr uint64_t stepMask = BitBoard<BOARD_SIZE>::GetStepMask<n>(0);
+	__m256i shifted = (n > 0) ? _mm256_slli_epi64(mask, n & 63) : _mm256_srli_epi64(mask, -n & 63);
+	return _mm256_and_si256(shifted, _mm256_set1_epi64x((long long)stepMask));
+}
+
+template<int n>
+inline void AddMovesVector(__m256i own, __m256i other, __m256i &moves)
+{
+	__m256i run = _mm256_and_si256(StepVector<n>(own), other);
+	for (int i = 0; i < BOARD_SIZE - 3; ++i)
+		run = _mm256_or_si256(run, _mm256_and_si256(StepVector<n>(run), other));
+	moves = _mm256_or_si256(moves, StepVector<n>(run));
+}
+#endif
+
+void RolloutBatch::CalcAllMoves()
+{
+#if defined(__AVX2__) && REVERSI_BOARD_SIZE <= 8
+	// 4 boards per vector, the directions of all lanes run without a branch
+	const int VECTOR_WIDTH = 4;
+	for (int i = 0; i < count; i += VECTOR_WIDTH)
+	{
+		__m256i o = _mm256_load_si256((const __m256i*)&own[i]);
+		__m256i p = _mm256_load_si256((const __m256i*)&other[i]);
+		__m256i m = _mm256_setzero_si256();
+		AddMovesVector<1>(o, p, m);
+		AddMovesVector<-1>(o, p, m);
+		AddMovesVector<BOARD_SIZE>(o, p, m);
+		AddMovesVector<-BOARD_SIZE>(o, p, m);
+		AddMovesVector<BOARD_SIZE + 1>(o, p, m);
+		AddMovesVector<-BOARD_SIZE - 1>(o, p, m);
+		AddMovesVector<BOARD_SIZE - 1>(o, p, m);
+		AddMovesVector<-BOARD_SIZE + 1>(o, p, m);
+		m = _mm256_andnot_si256(_mm256_or_si256(o, p), m);
+		_mm256_store_si256((__m256i*)&moves[i], m);
+	}
+#else
+	for (int i = 0; i < count; ++i)
+		moves[i] = BitBoard<BOARD_SIZE>::CalcMoves(own[i], other[i]);
+#endif
+}
+
+void RolloutBatch::Run()
+{
+	bool isRunning = true;
+	while (isRunning)
+	{
+		bool isPassStep[ROLLOUT_BATCH_MAX];
+		for (int lane = 0; lane < count; ++lane)
+		{
+			if (state[lane] != GameBase::E_NORMAL && state[lane] != GameBase::E_PASS)
+				continue;
+
+			if (GetEmptyCount(lane) <= solveEmpties)
+			{
+				int side = (turn[lane] % 2 == 1) ? Board::E_BLACK : Board::E_WHITE;
+				state[lane] = EndgameSolver::ToState(EndgameSolver::Solve(own[lane], other[lane]), side);
+				continue;
+			}
+
+			// validGridCount of GameBase: the legal grids of the highest priority present
+			GridMask filled = own[lane] | other[lane];
+			int key = 0;
+			for (int i = 0; i < 4; ++i)
+				key |= TestMaskGrid(filled, cornerGrids[i]) << i;
+
+			int validGridCount = 0;
+			for (int i = 0; i < Board::E_PRIORITY_MAX && validGridCount == 0; ++i)
+				validGridCount = CountMaskGrids(moves[lane] & priorityMasks[key][i]);
+
+			weight[lane] *= max(1 - branchFactor * validGridCount, 0.5f);
+
+			bool isBlack = (turn[lane] % 2 == 1);
+			lastBlackCount[lane] = CountMaskGrids(isBlack ? own[lane] : other[lane]);
+			lastWhiteCount[lane] = CountMaskGrids(isBlack ? other[lane] : own[lane]);
+
+			isPassStep[lane] = IsMaskEmpty(moves[lane]);
+			int id = -1;
+			if (!isPassStep[lane])
+			{
+				id = isPolicyPlayout ? PickPolicyMove(lane) : PickMove(lane);
+				GridMask flips = BitBoard<BOARD_SIZE>::CalcFlips(own[lane], other[lane], id);
+				SetMaskGrid(flips, id);
+				own[lane] |= flips;
+				other[lane] &= ~flips;
+				SetMaskGrid(playedGrids[lane][isBlack ? 0 : 1], id);
+			}
+			lastMove[lane] = id;
+			playoutMoves[lane][turn[lane] - startTurn[lane]] = (id < 0) ? GRID_NUM : id;
+
+			swap(own[lane], other[lane]);
+			turn[lane]++;
+		}
+
+		CalcAllMoves();
+
+		isRunning = false;
+		for (int lane = 0; lane < count; ++lane)
+		{
+			if (state[lane] != GameBase::E_NORMAL && state[lane] != GameBase::E_PASS)
+				continue;
+
+			FinishStep(lane, isPassStep[lane]);
+			isRunning = isRunning || state[lane] == GameBase::E_NORMAL || state[lane] == GameBase::E_PASS;
+		}
+	}
+
+	if (history != NULL)
+	{
+		for (int lane = 0; lane < count; ++lane)
+			history->Update(startSide[lane], startLastMove[lane], playoutMoves[lane], turn[lane] - startTurn[lane], state[lane]);
+	}
+}
+
+void RolloutBatch::FinishStep(int lane, bool isPassStep)
+{
+	bool isBlack = (turn[lane] % 2 == 1);
+	const GridMask &black = isBlack ? own[lane] : other[lane];
+	const GridMask &white = isBlack ? other[lane] : own[lane];
+	int blackCount = CountMaskGrids(black);
+	int whiteCount = CountMaskGrids(white);
+	bool hasMoves = !IsMaskEmpty(moves[lane]);
+
+	// GameBase::PutChess
+	if (blackCount == 0 || whiteCount == 0 || blackCount + whiteCount == GRID_NUM || (isPassStep && !hasMoves))
+		state[lane] = (blackCount == whiteCount) ? GameBase::E_DRAW : ((blackCount > whiteCount) ? GameBase::E_BLACK_WIN : GameBase::E_WHITE_WIN);
+	else
+		state[lane] = hasMoves ? GameBase::E_NORMAL : GameBase::E_PASS;
+
+	// the checks of MCTS::DefaultPolicy after each move, in the same order
+	int stableWinner = Board::E_EMPTY;
+	if (blackCount > GRID_NUM / 2 && CountMaskGrids(BitBoard<BOARD_SIZE>::CalcStable(black, white)) > GRID_NUM / 2)
+		stableWinner = Board::E_BLACK;
+	else if (whiteCount > GRID_NUM / 2 && CountMaskGrids(BitBoard<BOARD_SIZE>::CalcStable(white, black)) > GRID_NUM / 2)
+		stableWinner = Board::E_WHITE;
+
+	if (stableWinner != Board::E_EMPTY)
+	{
+		state[lane] = stableWinner;
+		isStableStop[lane] = true;
+		return;
+	}
+
+	if (turn[lane] <= GRID_NUM / 2 && !IsMaskEmpty(moves[lane] & cornerMask))
+		state[lane] = isBlack ? Board::E_BLACK : Board::E_WHITE;
+
+	if (weight[lane] < fastStopThreshold)
+	{
+		isFastStop[lane] = true;
+		int blackSum = lastBlackCount[lane] + blackCount;
+		int whiteSum = lastWhiteCount[lane] + whiteCount;
+		state[lane] = (blackSum == whiteSum) ? GameBase::E_DRAW : ((blackSum > whiteSum) ? GameBase::E_BLACK_WIN : GameBase::E_WHITE_WIN);
+	}
+}
+
+int RolloutBatch::PickMove(int lane)
+{
+	// uniform among the legal grids of the highest priority, as GameBase::PutRandomChess
+	GridMask filled = own[lane] | other[lane];
+	int key = 0;
+	for (int i = 0; i < 4; ++i)
+		key |= TestMaskGrid(filled, cornerGrids[i]) << i;
+
+	GridMask candidates = GridMask();
+	for (int i = 0; i < Board::E_PRIORITY_MAX && IsMaskEmpty(candidates); ++i)
+		candidates = moves[lane] & priorityMasks[key][i];
+
+	// the last good reply to the previous move, if it is among them
+	if (history != NULL)
+	{
+		int reply = history->GetReply((turn[lane] % 2 == 1) ? Board::E_BLACK : Board::E_WHITE, lastMove[lane]);
+		if (reply >= 0 && TestMaskGrid(candidates, reply))
+			return reply;
+	}
+
+	for (int pick = rand() % CountMaskGrids(candidates); pick > 0; --pick)
+		PopMaskGrid(candidates);
+	return PopMaskGrid(candidates);
+}
+
+int RolloutBatch::PickPolicyMove(int lane)
+{
+	// softmax of the features of GameBase::PutPolicyChess, computed on the masks
+	array<uint8_t, GRID_NUM> grids;
+	int moveCount = 0;
+	GridMask remaining = moves[lane];
+	while (!IsMaskEmpty(remaining))
+		grids[moveCount++] = PopMaskGrid(remaining);
+
+	if (moveCount == 1)
+		return grids[0];
+
+	GridMask filled = own[lane] | other[lane];
+	int key = 0;
+	for (int i = 0; i < 4; ++i)
+		key |= TestMaskGrid(filled, cornerGrids[i]) << i;
+
+	GridMask empty = allMask & ~filled;
+	GridMask frontier = BitBoard<BOARD_SIZE>::CalcNeighbors(empty);
+
+	int side = (turn[lane] % 2 == 1) ? Board::E_BLACK : Board::E_WHITE;
+	array<float, GRID_NUM> score;
+	float maxScore = -1e9f;
+	for (int i = 0; i < moveCount; ++i)
+	{
+		int id = grids[i];
+		GridMask grid = GridMask();
+		SetMaskGrid(grid, id);
+
+		GridMask flips = BitBoard<BOARD_SIZE>::CalcFlips(own[lane], other[lane], id);
+		int flipCount = CountMaskGrids(flips);
+		int frontierCount = CountMaskGrids(flips & frontier);
+		int emptyCount = CountMaskGrids(BitBoard<BOARD_SIZE>::CalcNeighbors(grid) & empty);
+
+		bool isStable = TestMaskGrid(cornerMask, id);
+		if (!isStable && TestMaskGrid(edgeMask, id))
+		{
+			const GridMask &run0 = edgeRuns[id][0], &run1 = edgeRuns[id][1];
+			isStable = IsMaskEmpty(run0 & ~own[lane]) || IsMaskEmpty(run1 & ~own[lane]);
+		}
+
+		score[i] = POLICY_PRIORITY_WEIGHT[Board::GetGridPriority(key, id)] + POLICY_FLIP_WEIGHT * flipCount + POLICY_FRONTIER_FLIP_WEIGHT * frontierCount
+			+ POLICY_EMPTY_NEIGHBOR_WEIGHT * emptyCount + POLICY_STABLE_WEIGHT * (isStable ? 1.f : 0.f);
+		if (history != NULL)
+			score[i] += history->CalcBonus(side, lastMove[lane], id);
+		maxScore = max(maxScore, score[i]);
+	}
+
+	float sum = 0;
+	for (int i = 0; i < moveCount; ++i)
+	{
+		score[i] = expf(score[i] - maxScore);
+		sum += score[i];
+	}
+
+	float r = rand() * sum / (RAND_MAX + 1.f);
+	for (int i = 0; i < moveCount - 1; ++i)
+	{
+		r -= score[i];
+		if (r < 0)
+			return grids[i];
+	}
+	return grids[moveCount - 1];
+}
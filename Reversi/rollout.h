@@ -0,0 +1,70 @@
+#pragma once
+#include <mutex>
+#include "game.h"
+#include "history.h"
+
+const int ROLLOUT_BATCH_MAX = 16;	// lanes of a batch, a multiple of the vector width
+const int PLAYOUT_MOVE_MAX = GRID_NUM * 2;	// moves and passes of one playout
+
+// Playouts of several leaves advanced in lockstep on bare disc masks, one
+// move of every lane per step. The legal moves of all lanes are generated in
+// one vector pass, then each lane picks its move. A lane follows the same
+// rules as MCTS::DefaultPolicy in E_EVAL_ROLLOUT: the playout policy, the
+// branch factor weight with its fast stop, overwhelming and stable wins, and
+// the exact result once few grids are left.
+class RolloutBatch
+{
+public:
+	RolloutBatch(bool isPolicyPlayout, float fastStopThreshold, float branchFactor, int solveEmpties, PlayoutHistory *history = NULL);
+
+	static void Init();	// by MCTS, once per process however many threads construct one
+
+	int Add(GameBase &game);	// lane of the new playout
+	void Run();					// until every lane is decided
+
+	int GetCount() const { return count; }
+	int GetWinner(int lane) const { return state[lane]; }	// GameBase::State
+	float GetWeight(int lane) const { return weight[lane]; }
+	int GetSteps(int lane) const { return turn[lane] - startTurn[lane]; }
+	bool IsFastStop(int lane) const { return isFastStop[lane]; }
+	bool IsStableStop(int lane) const { return isStableStop[lane]; }
+	int GetEmptyCount(int lane) const { return GRID_NUM - CountMaskGrids(own[lane] | other[lane]); }
+	const GridMask& GetPlayedGrids(int lane, int side) const { return playedGrids[lane][side == Board::E_BLACK ? 0 : 1]; }
+
+private:
+	static void InitTables();
+	void CalcAllMoves();
+	int PickMove(int lane);
+	int PickPolicyMove(int lane);
+	void FinishStep(int lane, bool isPassStep);
+
+	bool isPolicyPlayout;	// softmax of GameBase::PutPolicyChess, else uniform among the top priority
+	PlayoutHistory *history;	// biases the moves and learns from the results, NULL: off
+	float fastStopThreshold, branchFactor;
+	int solveEmpties;	// lanes with this many empty grids are solved, 0: off
+	int count;
+
+	// side to move first, swapped after every move or pass
+	alignas(32) GridMask own[ROLLOUT_BATCH_MAX];
+	alignas(32) GridMask other[ROLLOUT_BATCH_MAX];
+	alignas(32) GridMask moves[ROLLOUT_BATCH_MAX];
+
+	int state[ROLLOUT_BATCH_MAX];
+	int turn[ROLLOUT_BATCH_MAX];
+	int startTurn[ROLLOUT_BATCH_MAX];
+	int lastBlackCount[ROLLOUT_BATCH_MAX];	// discs before the last move, for the fast stop
+	int lastWhiteCount[ROLLOUT_BATCH_MAX];
+	float weight[ROLLOUT_BATCH_MAX];
+	bool isFastStop[ROLLOUT_BATCH_MAX];
+	bool isStableStop[ROLLOUT_BATCH_MAX];
+	GridMask playedGrids[ROLLOUT_BATCH_MAX][2];	// grids each side moved to, black first
+	int lastMove[ROLLOUT_BATCH_MAX];	// -1: pass
+	int startSide[ROLLOUT_BATCH_MAX], startLastMove[ROLLOUT_BATCH_MAX];
+	uint8_t playoutMoves[ROLLOUT_BATCH_MAX][PLAYOUT_MOVE_MAX];	// for the history, GRID_NUM: pass
+
+	// Board::gridPriorityDict as masks, by priority key and priority
+	static array<array<GridMask, Board::E_PRIORITY_MAX>, GRID_PRIORITY_DICT_NUM> priorityMasks;
+	static array<int, 4> cornerGrids;	// in the order of Board::UpdatePriorityDictKey
+	static GridMask allMask, cornerMask, edgeMask;
+	static array<array<GridMask, 2>, GRID_NUM> edgeRuns;	// edge grids between a grid and the two ends of its edge
+};
@@ -0,0 +1,139 @@
+#include <cstdlib>
+#include <algorithm>
+#include "scheduler.h"
+#include "mcts.h"
+
+const int	SCHEDULER_SLICE_US = 5000;		// a worker looks for a more urgent search this often
+const int	GLOBAL_MEMORY_LIMIT_MB = 4096;
+const float	MEMORY_TIGHT_RATIO = 0.5f;		// idle trees give their pools back beyond this
+
+SearchScheduler& SearchScheduler::Instance()
+{
+	static SearchScheduler instance;
+	return instance;
+}
+
+SearchScheduler::SearchScheduler()
+{
+	workerNum = max((int)thread::hardware_concurrency(), 1);
+	isRunning = false;
+	nodeCount = 0;
+	maxNodes = (int64_t)GLOBAL_MEMORY_LIMIT_MB * 1024 * 1024 / TREE_NODE_BYTES;
+}
+
+SearchScheduler::~SearchScheduler()
+{
+	{
+		lock_guard<mutex> lock(schedulerMtx);
+		isRunning = false;
+	}
+	jobCv.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+}
+
+void SearchScheduler::Configure(int workerNum, int memoryLimit)
+{
+	lock_guard<mutex> lock(schedulerMtx);
+	if (workerNum > 0 && workers.empty())
+		this->workerNum = workerNum;
+	if (memoryLimit > 0)
+		maxNodes = (int64_t)memoryLimit * 1024 * 1024 / TREE_NODE_BYTES;
+}
+
+void SearchScheduler::Start()
+{
+	isRunning = true;
+	for (int i = 0; i < workerNum; ++i)
+		workers.push_back(thread(WorkerThread, this, rand()));
+}
+
+void SearchScheduler::Submit(SearchJob *job)
+{
+	lock_guard<mutex> lock(schedulerMtx);
+	if (workers.empty())
+		Start();
+
+	job->activeWorkers = 0;
+	job->slotMask = 0;
+	job->isFinished = false;
+	jobs.push_back(job);
+	jobCv.notify_all();
+}
+
+void SearchScheduler::Wait(SearchJob *job)
+{
+	unique_lock<mutex> lock(schedulerMtx);
+	doneCv.wait(lock, [job] { return job->isFinished && job->activeWorkers == 0; });
+	jobs.erase(find(jobs.begin(), jobs.end(), job));
+}
+
+void SearchScheduler::WorkerThread(SearchScheduler *scheduler, int seed)
+{
+	srand(seed); // need to call srand for each thread
+
+	unique_lock<mutex> lock(scheduler->schedulerMtx);
+	while (scheduler->isRunning)
+	{
+		int slot;
+		SearchJob *job = scheduler->PickJob(slot);
+		if (job == NULL)
+		{
+			scheduler->jobCv.wait(lock);
+			continue;
+		}
+
+		job->activeWorkers++;
+		job->slotMask |= 1u << slot;
+		lock.unlock();
+
+		bool isFinished = job->mcts->RunSlice(slot, chrono::steady_clock::now() + chrono::microseconds(SCHEDULER_SLICE_US));
+
+		lock.lock();
+		job->activeWorkers--;
+		job->slotMask &= ~(1u << slot);
+		job->isFinished = job->isFinished || isFinished;
+
+		if (job->isFinished && job->activeWorkers == 0)
+			scheduler->doneCv.notify_all();
+		else
+			scheduler->jobCv.notify_one(); // the slot is free again
+	}
+}
+
+SearchJob* SearchScheduler::PickJob(int &slot)
+{
+	SearchJob *result = NULL;
+	for (auto job : jobs)
+	{
+		if (job->isFinished || job->activeWorkers >= job->maxWorkers)
+			continue;
+
+		if (result == NULL || job->priority > result->priority || (job->priority == result->priority && job->deadline < result->deadline))
+			result = job;
+	}
+
+	if (result != NULL)
+		slot = BitScanForward64(~(uint64_t)result->slotMask);
+	return result;
+}
+
+bool SearchScheduler::ReserveNodes(int count, bool isForced)
+{
+	if (nodeCount.fetch_add(count) + count <= maxNodes || isForced)
+		return true;
+
+	nodeCount -= count;
+	return false;
+}
+
+void SearchScheduler::ReleaseNodes(int count)
+{
+	nodeCount -= count;
+}
+
+bool SearchScheduler::IsMemoryTight()
+{
+	return nodeCount > maxNodes * MEMORY_TIGHT_RATIO;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+class MCTS;
+
+// A search registered with the scheduler, lives on the stack of MCTS::Search.
+struct SearchJob
+{
+	MCTS *mcts;
+	chrono::steady_clock::time_point deadline;
+	int priority;			// higher is served first
+	int maxWorkers;			// also the number of thread slots of the search
+	int activeWorkers;
+	uint32_t slotMask;		// slots in use by workers
+	bool isFinished;		// no new slices once set
+};
+
+// One pool of worker threads shared by every search in the process. Workers
+// run short slices on the search with the highest priority and the earliest
+// deadline that has a free slot, so hundreds of concurrent games do not each
+// start their own threads. Also keeps the node budget of all search trees.
+class SearchScheduler
+{
+public:
+	static SearchScheduler& Instance();
+	~SearchScheduler();
+
+	// 0 keeps the current value, call before the first search
+	void Configure(int workerNum, int memoryLimit);
+	int GetWorkerNum() { return workerNum; }
+
+	// runs the job until MCTS::RunSlice reports the search finished
+	void Submit(SearchJob *job);
+	void Wait(SearchJob *job);
+
+	// nodes of all trees, false when the global budget is used up
+	bool ReserveNodes(int count, bool isForced = false);
+	void ReleaseNodes(int count);
+	bool IsMemoryTight();
+
+private:
+	SearchScheduler();
+	void Start();
+	static void WorkerThread(SearchScheduler *scheduler, int seed);
+	SearchJob* PickJob(int &slot);
+
+	int workerNum;
+	vector<thread> workers;
+	vector<SearchJob*> jobs;
+	bool isRunning;
+
+	mutex schedulerMtx;
+	condition_variable jobCv;	// a job or a free slot is available
+	condition_variable doneCv;	// a job has no worker left
+
+	atomic<int64_t> nodeCount;
+	int64_t maxNodes;
+};
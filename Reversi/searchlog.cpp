@@ -0,0 +1,154 @@
+#include <cstring>
+#include "searchlog.h"
+#include "game.h"
+
+const char* SEARCH_LOG_FILE = "MCTS.bin";
+const size_t SEARCH_LOG_QUEUE_MAX = 64;
+
+SearchLogger& SearchLogger::Instance()
+{
+	static SearchLogger logger;
+	return logger;
+}
+
+SearchLogger::SearchLogger()
+{
+	isStopping = false;
+	isWriting = false;
+
+	// one log per process, searches of all MCTS instances are tagged by instance id
+	if (fopen_s(&fp, SEARCH_LOG_FILE, "wb") != 0)
+		fp = NULL;
+	writer = thread(WriterThread, this);
+}
+
+SearchLogger::~SearchLogger()
+{
+	{
+		lock_guard<mutex> lock(queueMtx);
+		isStopping = true;
+	}
+	queueCv.notify_one();
+	writer.join();
+
+	if (fp != NULL)
+		fclose(fp);
+}
+
+void SearchLogger::Submit(vector<char> &&buffer)
+{
+	{
+		lock_guard<mutex> lock(queueMtx);
+		if (queue.size() >= SEARCH_LOG_QUEUE_MAX) // never block the search, drop the oldest snapshot instead
+			queue.pop_front();
+
+		queue.push_back(move(buffer));
+	}
+	queueCv.notify_one();
+}
+
+void SearchLogger::Flush()
+{
+	unique_lock<mutex> lock(queueMtx);
+	flushCv.wait(lock, [this] { return queue.empty() && !isWriting; });
+}
+
+void SearchLogger::WriterThread(SearchLogger *logger)
+{
+	unique_lock<mutex> lock(logger->queueMtx);
+	while (1)
+	{
+		logger->queueCv.wait(lock, [logger] { return logger->isStopping || !logger->queue.empty(); });
+
+		if (logger->queue.empty())
+		{
+			if (logger->isStopping)
+				break;
+			continue;
+		}
+
+		vector<char> buffer = move(logger->queue.front());
+		logger->queue.pop_front();
+		logger->isWriting = true;
+		lock.unlock();
+
+		if (logger->fp != NULL)
+		{
+			fwrite(buffer.data(), 1, buffer.size(), logger->fp);
+			fflush(logger->fp);
+		}
+
+		lock.lock();
+		logger->isWriting = false;
+		logger->flushCv.notify_all();
+	}
+}
+
+bool SearchLogger::Render(const string &logFile)
+{
+	FILE *in;
+	if (fopen_s(&in, logFile.c_str(), "rb") != 0)
+		return false;
+
+	SearchLogHeader header;
+	vector<SearchLogNode> nodes;
+	while (fread(&header, sizeof(header), 1, in) == 1)
+	{
+		if (header.magic != SEARCH_LOG_MAGIC)
+		{
+			printf("corrupted log record\n");
+			break;
+		}
+
+		nodes.resize(header.nodeCount);
+		if (header.nodeCount > 0 && fread(nodes.data(), sizeof(SearchLogNode), header.nodeCount, in) != header.nodeCount)
+			break;
+
+		SearchLogProfile logProfile;
+		bool hasProfile = (header.flags & E_LOG_FLAG_PROFILE) != 0;
+		if (hasProfile && fread(&logProfile, sizeof(logProfile), 1, in) != 1)
+			break;
+
+		Board board;
+		for (int i = 0; i < GRID_NUM; ++i)
+		{
+			if (header.grids[i] != Board::E_EMPTY)
+				board.SetGrid(i, header.grids[i], false);
+		}
+		board.CheckGridStatus(header.side);
+
+		printf("instance %u, search %u\n", header.instance, header.searchId);
+		board.Print(header.lastMove);
+		printf("time: %.2f, iteration: %d, depth: %d, value: %.1f\n", header.time, header.iteration, header.maxDepth, header.value);
+		printf("fast stop count: %d, average stop steps: %d\n", header.fastStopCount, header.fastStopSteps / (header.fastStopCount + 1));
+
+		if (hasProfile)
+		{
+			SearchProfile profile;
+			profile.enabled = true;
+			profile.cyclesPerSecond = logProfile.cyclesPerSecond;
+			memcpy(profile.total.phaseCycles, logProfile.phaseCycles, sizeof(logProfile.phaseCycles));
+			memcpy(profile.total.counters, logProfile.counters, sizeof(logProfile.counters));
+			memcpy(profile.total.lockWaitHist, logProfile.lockWaitHist, sizeof(logProfile.lockWaitHist));
+			profile.Print(stdout);
+		}
+
+		if (header.nodeCount > 0)
+		{
+			printf("===============================PrintTree=============================\n");
+			for (auto &node : nodes)
+			{
+				printf("%d", node.depth);
+				for (int j = 0; j < node.depth; ++j)
+					printf("   ");
+
+				printf("visit: %d, value: %.1f, score: %.4f, children: %d, move: %s\n", node.visit, node.value, node.score, node.childCount, Game::Id2Str(node.move).c_str());
+			}
+			printf("================================TreeEnd============================\n");
+		}
+		printf("\n");
+	}
+
+	fclose(in);
+	return true;
+}
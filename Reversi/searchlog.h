@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "profiler.h"
+#include "game.h"
+
+using namespace std;
+
+const uint32_t SEARCH_LOG_MAGIC = 0x474C5352 + BOARD_FORMAT_TAG; // "RSLG"
+
+enum SearchLogLevel
+{
+	E_LOG_NONE,
+	E_LOG_SUMMARY,	// search statistics and root position only
+	E_LOG_TREE,		// top 3 children of every node on the way down
+	E_LOG_FULL,		// every node of the tree
+};
+
+enum SearchLogFlag
+{
+	E_LOG_FLAG_PROFILE = 1,	// a SearchLogProfile follows the nodes
+};
+
+#pragma pack(push, 1)
+struct SearchLogHeader
+{
+	uint32_t magic;
+	uint32_t instance;
+	uint32_t searchId;
+	uint32_t nodeCount;		// number of SearchLogNode following the header
+	int8_t grids[GRID_NUM];
+	int8_t lastMove;
+	uint8_t side;
+	uint8_t level;
+	uint8_t flags;			// SearchLogFlag
+	int32_t iteration;
+	int32_t maxDepth;
+	int32_t fastStopCount;
+	int32_t fastStopSteps;
+	float time;
+	float value;			// root value
+};
+
+// nodes are stored in pre-order, depth tells where a node hangs
+struct SearchLogNode
+{
+	uint8_t depth;
+	int8_t move;
+	uint16_t childCount;
+	int32_t visit;
+	float value;
+	float score;
+};
+
+struct SearchLogProfile
+{
+	double cyclesPerSecond;
+	uint64_t phaseCycles[E_PHASE_MAX];
+	uint64_t counters[E_COUNTER_MAX];
+	uint64_t lockWaitHist[LOCK_WAIT_BUCKET_NUM];
+};
+#pragma pack(pop)
+
+// Search results are snapshotted into a compact buffer on the search thread,
+// the buffer is written to disk by a background thread. Use "reversi logview"
+// to render the binary log as text.
+class SearchLogger
+{
+public:
+	static SearchLogger& Instance();
+	~SearchLogger();
+
+	void Submit(vector<char> &&buffer);
+	void Flush();
+
+	static bool Render(const string &logFile);
+
+private:
+	SearchLogger();
+	static void WriterThread(SearchLogger *logger);
+
+	deque<vector<char>> queue;
+	mutex queueMtx;
+	condition_variable queueCv, flushCv;
+	thread writer;
+	bool isStopping;
+	bool isWriting;
+	FILE *fp;
+};
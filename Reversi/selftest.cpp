@@ -0,0 +1,436 @@
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include "selftest.h"
+#include "mcts.h"
+#include "gamedb.h"
+#include "endgame.h"
+#include "distributed.h"
+
+const int	SELFTEST_GAMES = 200;				// random games walked by the move and stable checks
+const int	SELFTEST_ENDGAME_EMPTIES = 8;		// brute force tries every move order from here
+const int	SELFTEST_ENDGAME_POSITIONS = 40;
+const int	SELFTEST_DB_GAMES = 20;
+const int	SELFTEST_CHECKPOINT_VISITS = 3000;
+const int	SELFTEST_RESUME_VISITS = 500;		// budget of the resumed search, the checkpoint already has more
+const int	SELFTEST_WORKER_PORT = 47301;		// loopback ports of the distributed check, one per worker
+const int	SELFTEST_WORKER_NUM = 2;
+const float	SELFTEST_WORKER_WAIT = 5;			// seconds for the workers to listen
+const float	SELFTEST_REMOTE_TIME = 1;
+
+const int	DIRECTIONS[8][2] = { { -1, -1 }, { -1, 0 }, { -1, 1 }, { 0, -1 }, { 0, 1 }, { 1, -1 }, { 1, 0 }, { 1, 1 } };
+
+static bool IsSameMask(const GridMask &a, const GridMask &b)
+{
+	return IsMaskEmpty((a & ~b) | (b & ~a));
+}
+
+static array<char, GRID_NUM> GetGrids(const Board &board)
+{
+	array<char, GRID_NUM> grids;
+	for (int i = 0; i < GRID_NUM; ++i)
+		grids[i] = board.GetGrid(i);
+	return grids;
+}
+
+// flips of a move by walking its 8 lines grid by grid, empty if the move is not legal
+static GridMask RefFlips(const array<char, GRID_NUM> &grids, int side, int id)
+{
+	GridMask flips = GridMask();
+	if (grids[id] != Board::E_EMPTY)
+		return flips;
+
+	int row, col;
+	Board::Id2Coord(id, row, col);
+	for (auto &dir : DIRECTIONS)
+	{
+		GridMask run = GridMask();
+		int row1 = row + dir[0], col1 = col + dir[1];
+		while (Board::IsValidCoord(row1, col1) && grids[Board::Coord2Id(row1, col1)] == Board::GetOtherSide(side))
+		{
+			SetMaskGrid(run, Board::Coord2Id(row1, col1));
+			row1 += dir[0];
+			col1 += dir[1];
+		}
+
+		if (Board::IsValidCoord(row1, col1) && grids[Board::Coord2Id(row1, col1)] == side)
+			flips |= run;
+	}
+	return flips;
+}
+
+static GridMask RefMoves(const array<char, GRID_NUM> &grids, int side)
+{
+	GridMask moves = GridMask();
+	for (int id = 0; id < GRID_NUM; ++id)
+	{
+		if (!IsMaskEmpty(RefFlips(grids, side, id)))
+			SetMaskGrid(moves, id);
+	}
+	return moves;
+}
+
+// EndgameSolver::Result of the side to move, every move order to the end of the game
+static int RefSolve(const array<char, GRID_NUM> &grids, int side, bool isPassed)
+{
+	int otherSide = Board::GetOtherSide(side);
+	int best = EndgameSolver::E_LOSS - 1;
+	for (int id = 0; id < GRID_NUM; ++id)
+	{
+		GridMask flips = RefFlips(grids, side, id);
+		if (IsMaskEmpty(flips))
+			continue;
+
+		array<char, GRID_NUM> next = grids;
+		next[id] = side;
+		while (!IsMaskEmpty(flips))
+			next[PopMaskGrid(flips)] = side;
+		best = max(best, -RefSolve(next, otherSide, false));
+	}
+
+	if (best >= EndgameSolver::E_LOSS)
+		return best;
+	if (!isPassed)
+		return -RefSolve(grids, otherSide, true);
+
+	int diff = 0;
+	for (auto grid : grids)
+		diff += (grid == side) ? 1 : ((grid == otherSide) ? -1 : 0);
+	return (diff > 0) ? EndgameSolver::E_WIN : ((diff < 0) ? EndgameSolver::E_LOSS : EndgameSolver::E_DRAW);
+}
+
+// nodes of a checkpoint file, false unless the children of every node follow the earlier ones in order
+static bool ReadCheckpoint(const string &file, vector<CheckpointNode> &records)
+{
+	FILE *fp;
+	if (fopen_s(&fp, file.c_str(), "rb") != 0)
+		return false;
+
+	CheckpointHeader header;
+	bool isValid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == CHECKPOINT_MAGIC && header.nodeCount > 0;
+	if (isValid)
+	{
+		records.resize(header.nodeCount);
+		isValid = fread(records.data(), sizeof(CheckpointNode), records.size(), fp) == records.size() && fgetc(fp) == EOF;
+	}
+	fclose(fp);
+
+	uint64_t nextIndex = 1;
+	for (size_t i = 0; isValid && i < records.size(); ++i)
+	{
+		const CheckpointNode &record = records[i];
+		isValid = record.firstChild == nextIndex && nextIndex + record.childCount <= records.size();
+
+		int childVisit = 0;
+		for (int j = 0; isValid && j < record.childCount; ++j)
+			childVisit += records[record.firstChild + j].visit;
+		isValid = isValid && childVisit <= record.visit;
+		nextIndex += record.childCount;
+	}
+	return isValid && nextIndex == records.size();
+}
+
+SelfTest::SelfTest(const string &dir)
+{
+	this->dir = dir;
+}
+
+bool SelfTest::Run()
+{
+	struct Check
+	{
+		const char *name;
+		bool (SelfTest::*run)();
+	};
+
+	const Check checks[] = {
+		{ "moves", &SelfTest::TestMoves },
+		{ "stable", &SelfTest::TestStable },
+		{ "endgame", &SelfTest::TestEndgame },
+		{ "gamedb", &SelfTest::TestGameDb },
+		{ "checkpoint", &SelfTest::TestCheckpoint },
+		{ "distributed", &SelfTest::TestDistributed },
+	};
+
+	bool isPassed = true;
+	for (auto &check : checks)
+	{
+		// the same random games on every run
+		srand(1);
+		bool isOk = (this->*check.run)();
+		printf("%-12s %s\n", check.name, isOk ? "ok" : "FAILED");
+		isPassed = isPassed && isOk;
+	}
+	return isPassed;
+}
+
+// BitBoard moves and flips against walking the lines of the board
+bool SelfTest::TestMoves()
+{
+	for (int i = 0; i < SELFTEST_GAMES; ++i)
+	{
+		GameBase game;
+		while (!game.IsGameFinish())
+		{
+			int side = game.GetSide();
+			array<char, GRID_NUM> grids = GetGrids(game.board);
+			const GridMask &own = game.board.GetDiscMask(side);
+			const GridMask &other = game.board.GetDiscMask(Board::GetOtherSide(side));
+
+			GridMask moves = BitBoard<BOARD_SIZE>::CalcMoves(own, other);
+			if (!IsSameMask(moves, RefMoves(grids, side)))
+			{
+				printf("moves: game %d turn %d, legal grids differ\n", i, game.turn);
+				return false;
+			}
+
+			while (!IsMaskEmpty(moves))
+			{
+				int id = PopMaskGrid(moves);
+				if (!IsSameMask(BitBoard<BOARD_SIZE>::CalcFlips(own, other, id), RefFlips(grids, side, id)))
+				{
+					printf("moves: game %d turn %d, flips of %s differ\n", i, game.turn, Game::Id2Str(id).c_str());
+					return false;
+				}
+			}
+
+			PlayRandomMove(game);
+		}
+	}
+	return true;
+}
+
+// discs CalcStable calls stable are never flipped for the rest of the game
+bool SelfTest::TestStable()
+{
+	for (int i = 0; i < SELFTEST_GAMES; ++i)
+	{
+		GameBase game;
+		array<GridMask, 3> stable;
+		stable.fill(GridMask());
+
+		while (true)
+		{
+			for (int side = Board::E_BLACK; side <= Board::E_WHITE; ++side)
+			{
+				const GridMask &own = game.board.GetDiscMask(side);
+				if (!IsMaskEmpty(stable[side] & ~own))
+				{
+					printf("stable: game %d turn %d, a stable disc was flipped\n", i, game.turn);
+					return false;
+				}
+				stable[side] |= BitBoard<BOARD_SIZE>::CalcStable(own, game.board.GetDiscMask(Board::GetOtherSide(side)));
+			}
+
+			if (game.IsGameFinish())
+				break;
+			PlayRandomMove(game);
+		}
+	}
+	return true;
+}
+
+// EndgameSolver against trying every move order
+bool SelfTest::TestEndgame()
+{
+	int positions = 0;
+	while (positions < SELFTEST_ENDGAME_POSITIONS)
+	{
+		GameBase game;
+		while (!game.IsGameFinish() && GRID_NUM - game.board.blackCount - game.board.whiteCount > SELFTEST_ENDGAME_EMPTIES)
+			PlayRandomMove(game);
+		if (game.IsGameFinish())
+			continue;
+
+		int side = game.GetSide();
+		int result = EndgameSolver::Solve(game.board.GetDiscMask(side), game.board.GetDiscMask(Board::GetOtherSide(side)));
+		int expected = RefSolve(GetGrids(game.board), side, false);
+		if (result != expected)
+		{
+			printf("endgame: position %d, solved %d, brute force %d\n", positions, result, expected);
+			return false;
+		}
+		++positions;
+	}
+	return true;
+}
+
+// games appended to a database read back the same
+bool SelfTest::TestGameDb()
+{
+	string file = GetPath("selftest.rvdb");
+	filesystem::remove(file);
+	filesystem::remove(file + ".idx");
+	filesystem::remove(file + ".players");
+
+	vector<GameBase> games(SELFTEST_DB_GAMES);
+	vector<vector<uint8_t>> moves(SELFTEST_DB_GAMES);
+	GameDbWriter writer;
+	bool isValid = writer.Open(file);
+	for (int i = 0; isValid && i < SELFTEST_DB_GAMES; ++i)
+	{
+		// the record keeps passes as 255 like Game does, the database leaves them out
+		vector<uint8_t> record;
+		while (!games[i].IsGameFinish())
+		{
+			PlayRandomMove(games[i]);
+			record.push_back(games[i].lastMove);
+			if (games[i].lastMove >= 0)
+				moves[i].push_back(games[i].lastMove);
+		}
+		isValid = writer.Append(record, "black " + to_string(i % 3), "white");
+	}
+	writer.Close();
+
+	GameDbReader reader;
+	isValid = isValid && reader.Open(file) && reader.GetGameCount() == SELFTEST_DB_GAMES;
+	for (int i = 0; isValid && i < SELFTEST_DB_GAMES; ++i)
+	{
+		GameDbGame game;
+		isValid = reader.GetGame(i, game) && game.moves == moves[i] && game.state == games[i].state
+			&& game.discDiff == games[i].board.blackCount - games[i].board.whiteCount
+			&& game.blackPlayer == "black " + to_string(i % 3) && game.whitePlayer == "white";
+		if (!isValid)
+			printf("gamedb: game %d differs\n", i);
+	}
+	reader.Close();
+
+	filesystem::remove(file);
+	filesystem::remove(file + ".idx");
+	filesystem::remove(file + ".players");
+	return isValid;
+}
+
+// a search resumed from a checkpoint keeps the visits of the first one
+bool SelfTest::TestCheckpoint()
+{
+	string file = GetPath("selftest.ckpt");
+	filesystem::remove(file);
+
+	Game game;
+	for (int i = 0; i < 10 && !game.IsGameFinish(); ++i)
+	{
+		if (game.GetState() == GameBase::E_PASS)
+			game.PutChess(-1);
+		else
+			while (!game.PutChess(rand() % GRID_NUM));
+	}
+
+	MCTSConfig config;
+	config.threadNum = 1;
+	config.logLevel = E_LOG_NONE;
+	config.searchTime = 60;
+	config.visitLimit = SELFTEST_CHECKPOINT_VISITS;
+	config.checkpointFile = file;
+
+	vector<CheckpointNode> first, second;
+	{
+		MCTS ai(0, config);
+		ai.Search(&game);
+	}
+	bool isValid = ReadCheckpoint(file, first) && first[0].visit >= SELFTEST_CHECKPOINT_VISITS;
+
+	if (isValid)
+	{
+		config.visitLimit = SELFTEST_RESUME_VISITS;
+		MCTS ai(0, config);
+		ai.Search(&game);
+		isValid = ReadCheckpoint(file, second) && second[0].visit >= first[0].visit && second.size() >= first.size();
+	}
+
+	// a new search would stop at the smaller budget, a resumed one keeps every node and only adds to every root move
+	for (int i = 0; isValid && i < first[0].childCount; ++i)
+	{
+		const CheckpointNode &child = first[first[0].firstChild + i];
+		bool isFound = false;
+		for (int j = 0; j < second[0].childCount && !isFound; ++j)
+		{
+			const CheckpointNode &resumed = second[second[0].firstChild + j];
+			isFound = resumed.move == child.move && resumed.visit >= child.visit;
+		}
+		isValid = isFound;
+	}
+
+	if (!isValid)
+		printf("checkpoint: %s is not a valid resumed tree\n", file.c_str());
+	filesystem::remove(file);
+	return isValid;
+}
+
+bool SelfTest::TestDistributed()
+{
+	MCTSConfig config;
+	config.threadNum = 1;
+	config.logLevel = E_LOG_NONE;
+
+	// the listeners never return, their workers live until the process exits
+	string addresses;
+	for (int i = 0; i < SELFTEST_WORKER_NUM; ++i)
+	{
+		SearchWorker *worker = new SearchWorker(config);
+		int port = SELFTEST_WORKER_PORT + i;
+		thread([worker, port] { worker->Run("127.0.0.1", port); }).detach();
+		addresses += (i > 0 ? "+127.0.0.1:" : "127.0.0.1:") + to_string(port);
+	}
+
+	// a connection without a search request is dropped by the worker
+	TimePoint startTime = chrono::steady_clock::now();
+	for (int i = 0; i < SELFTEST_WORKER_NUM; ++i)
+	{
+		Socket probe;
+		while (!probe.Connect("127.0.0.1:" + to_string(SELFTEST_WORKER_PORT + i)) && GetElapsedTime(startTime) < SELFTEST_WORKER_WAIT)
+			this_thread::sleep_for(chrono::milliseconds(50));
+	}
+
+	GameBase position;
+	for (int i = 0; i < 6; ++i)
+		PlayRandomMove(position);
+	Game game;
+	*((GameBase*)&game) = position;
+
+	config.searchTime = SELFTEST_REMOTE_TIME;
+	config.remoteWorkers = addresses;
+	MCTS ai(0, config);
+
+	// the merged visits are looked at before the tree is cleared
+	int localVisit = 0, mergedVisit = 0;
+	ai.SetMoveCallback([&](int)
+	{
+		vector<ShallowStat> stats;
+		SearchInfo info;
+		if (ai.GetShallowStats(stats, 1) && ai.GetSearchInfo(info, GRID_NUM))
+		{
+			for (auto &stat : stats)
+				localVisit += stat.visit;
+			mergedVisit = info.visit;
+		}
+	});
+
+	int side = position.GetSide();
+	GridMask moves = BitBoard<BOARD_SIZE>::CalcMoves(position.board.GetDiscMask(side), position.board.GetDiscMask(Board::GetOtherSide(side)));
+	int move = ai.Search(&game);
+	if (move < 0 || move >= GRID_NUM || !TestMaskGrid(moves, move) || mergedVisit <= localVisit)
+	{
+		printf("distributed: move %d, %d local visits, %d merged\n", move, localVisit, mergedVisit);
+		return false;
+	}
+	return true;
+}
+
+// a uniform random legal move or the pass
+bool SelfTest::PlayRandomMove(GameBase &game)
+{
+	if (game.state == GameBase::E_PASS)
+		return game.PutChess(-1);
+
+	int side = game.GetSide();
+	GridMask moves = BitBoard<BOARD_SIZE>::CalcMoves(game.board.GetDiscMask(side), game.board.GetDiscMask(Board::GetOtherSide(side)));
+	for (int i = rand() % CountMaskGrids(moves); i > 0; --i)
+		PopMaskGrid(moves);
+	return game.PutChess(PopMaskGrid(moves));
+}
+
+string SelfTest::GetPath(const string &file)
+{
+	return (filesystem::path(dir) / file).string();
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include "game.h"
+
+using namespace std;
+
+// Checks of the search building blocks against slow but obvious versions of
+// them, run by "reversi test". Every check prints one line, files are written
+// to the work dir and removed at the end.
+class SelfTest
+{
+public:
+	SelfTest(const string &dir);
+	bool Run();	// false if any check fails
+
+private:
+	bool TestMoves();
+	bool TestStable();
+	bool TestEndgame();
+	bool TestGameDb();
+	bool TestCheckpoint();
+	bool TestDistributed();
+
+	bool PlayRandomMove(GameBase &game);
+	string GetPath(const string &file);
+
+	string dir;
+};
@@ -0,0 +1,305 @@
+#include <thread>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include "train.h"
+
+const int	TRAIN_EPOCHS = 20;
+const float	TRAIN_RATE = 0.01f;
+const int	TRAIN_CHUNK_GAMES = 4096;
+
+RecordReader::RecordReader()
+{
+	isGameDb = false;
+	gameIndex = 0;
+}
+
+bool RecordReader::Open(const string &file)
+{
+	stream.close();
+	stream.clear();
+	gameIndex = 0;
+
+	isGameDb = GameDbReader::IsGameDb(file);
+	if (isGameDb)
+		return gameDb.Open(file);
+
+	stream.open(file);
+	return stream.is_open();
+}
+
+bool RecordReader::Next(vector<uint8_t> &moves)
+{
+	if (isGameDb)
+	{
+		const GameDbRecord *record = gameDb.GetRecord(gameIndex++);
+		if (record == NULL)
+			return false;
+
+		moves.resize(record->moveCount);
+		for (int i = 0; i < record->moveCount; ++i)
+			moves[i] = GameDbReader::GetMove(record, i);
+		return true;
+	}
+
+	string line;
+	while (getline(stream, line))
+	{
+		if (ParseRecord(line, moves) && !moves.empty())
+			return true;
+	}
+	return false;
+}
+
+bool RecordReader::ParseRecord(const string &line, vector<uint8_t> &moves)
+{
+	moves.clear();
+
+	for (size_t i = 0; i < line.size();)
+	{
+		if (isspace((unsigned char)line[i]))
+		{
+			++i;
+			continue;
+		}
+
+		// a column letter and the row digits, two of them for row 10
+		size_t length = 1;
+		while (length < 3 && i + length < line.size() && isdigit((unsigned char)line[i + length]))
+			++length;
+
+		string token = line.substr(i, max(length, (size_t)2));
+		transform(token.begin(), token.end(), token.begin(), ::toupper);
+
+		if (token == "PA") // "pass"
+		{
+			i += (line.compare(i, 4, "pass") == 0 || line.compare(i, 4, "PASS") == 0) ? 4 : 2;
+			continue;
+		}
+
+		int id = Game::Str2Id(token);
+		if (id == -1)
+			return false;
+
+		moves.push_back(id);
+		i += token.size();
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+TrainOptions::TrainOptions()
+{
+	epochs = TRAIN_EPOCHS;
+	rate = TRAIN_RATE;
+	threadNum = 0;
+	chunkGames = TRAIN_CHUNK_GAMES;
+	outputWeights = EVAL_WEIGHT_FILE;
+}
+
+bool TrainOptions::Set(const string &key, const string &value)
+{
+	if (key == "epochs")
+		epochs = stoi(value);
+	else if (key == "rate")
+		rate = stof(value);
+	else if (key == "threads")
+		threadNum = stoi(value);
+	else if (key == "chunk")
+		chunkGames = max(stoi(value), 1);
+	else if (key == "out")
+		outputWeights = value;
+	else
+		return false;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Trainer::Trainer(const TrainOptions &options)
+{
+	this->options = options;
+
+	Evaluator::Init();
+	weightNum = Evaluator::GetWeightNum();
+
+	threadNum = (options.threadNum > 0) ? options.threadNum : thread::hardware_concurrency();
+	threadNum = max(threadNum, 1);
+}
+
+bool Trainer::Run(const vector<string> &files)
+{
+	threadGrads.assign(threadNum, vector<float>(EVAL_STAGE_NUM * weightNum));
+	threadCounts.assign(threadNum, vector<uint32_t>(EVAL_STAGE_NUM * weightNum));
+	threadLoss.assign(threadNum, 0);
+	threadSamples.assign(threadNum, 0);
+	threadBadGames.assign(threadNum, 0);
+
+	for (int epoch = 0; epoch < options.epochs; ++epoch)
+	{
+		double loss = 0;
+		long long samples = 0;
+		int games = 0, badGames = 0;
+
+		// records are streamed chunk by chunk, the whole data set never sits in memory
+		for (auto &file : files)
+		{
+			RecordReader reader;
+			if (!reader.Open(file))
+			{
+				printf("train: cannot open %s\n", file.c_str());
+				return false;
+			}
+
+			vector<uint8_t> moves;
+			chunk.clear();
+			while (1)
+			{
+				bool hasMore = reader.Next(moves);
+				if (hasMore)
+					chunk.push_back(moves);
+
+				if (chunk.size() >= (size_t)options.chunkGames || (!hasMore && !chunk.empty()))
+				{
+					TrainChunk();
+
+					games += chunk.size();
+					for (int i = 0; i < threadNum; ++i)
+					{
+						loss += threadLoss[i];
+						samples += threadSamples[i];
+						badGames += threadBadGames[i];
+					}
+					chunk.clear();
+				}
+
+				if (!hasMore)
+					break;
+			}
+		}
+
+		printf("epoch %d: %d games (%d skipped), %lld positions, rmse %.3f discs\n", epoch + 1, games, badGames, samples, sqrt(loss / max(samples, 1LL)));
+		fflush(stdout);
+	}
+
+	if (!Evaluator::SaveWeights(options.outputWeights))
+	{
+		printf("train: cannot write %s\n", options.outputWeights.c_str());
+		return false;
+	}
+
+	printf("train: weights written to %s\n", options.outputWeights.c_str());
+	return true;
+}
+
+void Trainer::TrainChunk()
+{
+	vector<thread> threads;
+	for (int i = 0; i < threadNum; ++i)
+		threads.push_back(thread(GradientThread, this, i));
+
+	for (auto &t : threads)
+		t.join();
+
+	threads.clear();
+	for (int i = 0; i < threadNum; ++i)
+		threads.push_back(thread(UpdateThread, this, i));
+
+	for (auto &t : threads)
+		t.join();
+}
+
+void Trainer::GradientThread(Trainer *trainer, int id)
+{
+	vector<float> &grads = trainer->threadGrads[id];
+	vector<uint32_t> &counts = trainer->threadCounts[id];
+	fill(grads.begin(), grads.end(), 0.f);
+	fill(counts.begin(), counts.end(), 0);
+
+	double loss = 0;
+	long long samples = 0;
+	int badGames = 0;
+	vector<Board> positions;
+
+	for (size_t g = id; g < trainer->chunk.size(); g += trainer->threadNum)
+	{
+		// replay the game first, the final disc difference is the target of every position
+		GameBase game;
+		positions.clear();
+
+		bool isValid = true;
+		for (auto move : trainer->chunk[g])
+		{
+			if (!game.PutRecordMove(move))
+			{
+				isValid = false;
+				break;
+			}
+
+			if (!game.IsGameFinish())
+				positions.push_back(game.board);
+		}
+
+		if (game.state == GameBase::E_PASS) // a trailing pass ends the game when neither side can move
+			game.PutChess(-1);
+
+		if (!isValid || !game.IsGameFinish())
+		{
+			++badGames;
+			continue;
+		}
+
+		float target = game.board.blackCount - game.board.whiteCount;
+		for (auto &board : positions)
+		{
+			int stage = Evaluator::GetStage(board);
+			int stageOffset = stage * trainer->weightNum;
+
+			float error = Evaluator::Evaluate(board) - target;
+			for (int i = 0; i < PATTERN_INSTANCE_NUM; ++i)
+			{
+				int index = stageOffset + Evaluator::GetTypeOffset(Pattern::instanceType[i]) + board.GetPatternCode(i);
+				grads[index] += error;
+				counts[index]++;
+			}
+
+			loss += error * error;
+			++samples;
+		}
+	}
+
+	trainer->threadLoss[id] = loss;
+	trainer->threadSamples[id] = samples;
+	trainer->threadBadGames[id] = badGames;
+}
+
+void Trainer::UpdateThread(Trainer *trainer, int id)
+{
+	// every weight moves by its own mean residual, rarely seen patterns are damped
+	int weightNum = trainer->weightNum;
+	int threadNum = trainer->threadNum;
+
+	for (int stage = 0; stage < EVAL_STAGE_NUM; ++stage)
+	{
+		float *weights = Evaluator::GetWeights(stage);
+		int stageOffset = stage * weightNum;
+
+		int begin = (long long)weightNum * id / threadNum;
+		int end = (long long)weightNum * (id + 1) / threadNum;
+		for (int i = begin; i < end; ++i)
+		{
+			float grad = 0;
+			uint32_t count = 0;
+			for (int t = 0; t < threadNum; ++t)
+			{
+				grad += trainer->threadGrads[t][stageOffset + i];
+				count += trainer->threadCounts[t][stageOffset + i];
+			}
+
+			if (count > 0)
+				weights[i] -= trainer->options.rate * grad / (count + 1);
+		}
+	}
+}
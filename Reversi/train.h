@@ -0,0 +1,62 @@
+#pragma once
+#include <fstream>
+#include "eval.h"
+#include "gamedb.h"
+
+// Text game records, one game per line such as "F5D6C3D3C4...",
+// passes are implied by the position and may be left out.
+// A game database is read in place instead when the file is one.
+class RecordReader
+{
+public:
+	RecordReader();
+	bool Open(const string &file);
+	bool Next(vector<uint8_t> &moves);
+
+	static bool ParseRecord(const string &line, vector<uint8_t> &moves);
+
+private:
+	ifstream stream;
+	bool isGameDb;
+	GameDbReader gameDb;
+	uint64_t gameIndex;
+};
+
+class TrainOptions
+{
+public:
+	TrainOptions();
+	bool Set(const string &key, const string &value);
+
+	int epochs;
+	float rate;			// step size of the per-weight gradient update
+	int threadNum;		// 0: use all hardware threads
+	int chunkGames;		// games read per gradient step, bounds the memory use
+	string outputWeights;
+};
+
+// Fits the pattern weights of Evaluator to the final disc difference of
+// recorded games by gradient descent on the squared error. Training starts
+// from the weights currently loaded by the engine.
+class Trainer
+{
+public:
+	Trainer(const TrainOptions &options);
+	bool Run(const vector<string> &files);
+
+private:
+	static void GradientThread(Trainer *trainer, int id);
+	static void UpdateThread(Trainer *trainer, int id);
+	void TrainChunk();
+
+	TrainOptions options;
+	int threadNum;
+	int weightNum;
+
+	vector<vector<uint8_t>> chunk;
+	vector<vector<float>> threadGrads;		// [thread][stage * weightNum + weight]
+	vector<vector<uint32_t>> threadCounts;
+	vector<double> threadLoss;
+	vector<long long> threadSamples;
+	vector<int> threadBadGames;
+};
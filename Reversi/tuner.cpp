@@ -0,0 +1,192 @@
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <algorithm>
+#include "tuner.h"
+
+const int	TUNE_ITERATIONS = 200;
+const int	TUNE_GAMES_PER_ITERATION = 16;
+const float	TUNE_SEARCH_TIME = 0.1f;
+const string TUNE_OUTPUT_FILE = "tuned.cfg";
+
+const float	SPSA_RATE = 2.f;		// steps moved at the first iteration by a full score, the first perturbation is one step
+const float	SPSA_STABILITY = 0.1f;	// part of the iterations delaying the rate decay
+const float	SPSA_ALPHA = 0.602f;	// rate decay
+const float	SPSA_GAMMA = 0.101f;	// perturbation decay
+
+TuneOptions::TuneOptions()
+{
+	iterations = TUNE_ITERATIONS;
+	gamesPerIteration = TUNE_GAMES_PER_ITERATION;
+	searchTime = TUNE_SEARCH_TIME;
+	threadNum = 1;
+	concurrency = 0;
+	outputFile = TUNE_OUTPUT_FILE;
+}
+
+bool TuneOptions::Set(const string &key, const string &value)
+{
+	if (key == "iterations")
+		iterations = max(stoi(value), 1);
+	else if (key == "games")
+		gamesPerIteration = max(stoi(value), 2);
+	else if (key == "time")
+		searchTime = stof(value);
+	else if (key == "threads")
+		threadNum = max(stoi(value), 1);
+	else if (key == "concurrency")
+		concurrency = stoi(value);
+	else if (key == "params")
+		paramKeys = value;
+	else if (key == "base")
+		baseConfig = value;
+	else if (key == "output")
+		outputFile = value;
+	else
+		return false;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+
+Tuner::Tuner(const TuneOptions &options)
+{
+	this->options = options;
+}
+
+bool Tuner::Run()
+{
+	if (!baseConfig.Parse(options.baseConfig))
+	{
+		printf("tune: invalid base config %s\n", options.baseConfig.c_str());
+		return false;
+	}
+	baseConfig.searchTime = options.searchTime;
+	baseConfig.threadNum = options.threadNum;
+	baseConfig.logLevel = E_LOG_NONE;
+
+	vector<TuneParam> allParams =
+	{
+		{ "cuct", baseConfig.cUct, 0.2f, 5.f, 0.3f, false },
+		{ "expand", (float)baseConfig.expandThreshold, 1.f, 16.f, 2.f, true },
+		{ "fstop", baseConfig.fastStopThreshold, 0.01f, 0.5f, 0.03f, false },
+		{ "fsbranch", baseConfig.fastStopBranchFactor, 0.f, 0.05f, 0.004f, false },
+		{ "trymore", (float)baseConfig.tryMoreThreshold, 50.f, 20000.f, 300.f, true },
+	};
+
+	params.clear();
+	for (auto &param : allParams)
+	{
+		if (options.paramKeys.empty() || ("+" + options.paramKeys + "+").find("+" + param.key + "+") != string::npos)
+			params.push_back(param);
+	}
+	if (params.empty())
+	{
+		printf("tune: no tunable parameter in %s\n", options.paramKeys.c_str());
+		return false;
+	}
+
+	ArenaOptions arenaOptions;
+	arenaOptions.maxGames = (options.gamesPerIteration + 1) / 2 * 2;
+	arenaOptions.concurrency = options.concurrency;
+	arenaOptions.elo0 = arenaOptions.elo1 = 0; // no sprt stop, the llr stays 0
+	arenaOptions.isQuiet = true;
+
+	vector<float> values(params.size());
+	for (size_t i = 0; i < params.size(); ++i)
+		values[i] = params[i].value;
+
+	printf("tune: %d iterations of %d games at %gs, %d threads, start %s\n", options.iterations, arenaOptions.maxGames,
+		options.searchTime, options.threadNum, FormatParams(values).c_str());
+
+	mt19937 random(rand());
+	float stability = SPSA_STABILITY * options.iterations;
+	for (int k = 0; k < options.iterations; ++k)
+	{
+		float shrink = 1 / powf(k + 1.f, SPSA_GAMMA);
+
+		// integer parameters move by one at least, a smaller perturbation rounds away
+		vector<float> deltas(params.size()), plus(params.size()), minus(params.size());
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			float sign = (random() & 1) ? 1.f : -1.f;
+			float delta = params[i].step * shrink;
+			if (params[i].isInteger)
+				delta = max(roundf(delta), 1.f);
+			plus[i] = min(max(values[i] + delta * sign, params[i].minValue), params[i].maxValue);
+			minus[i] = min(max(values[i] - delta * sign, params[i].minValue), params[i].maxValue);
+			deltas[i] = (plus[i] - minus[i]) / 2; // as played, a bound may cut one side
+		}
+
+		ArenaEngine engines[2];
+		engines[0].name = "plus";
+		engines[0].config = MakeConfig(plus);
+		engines[1].name = "minus";
+		engines[1].config = MakeConfig(minus);
+
+		// each iteration moves on through the openings
+		arenaOptions.firstOpening = k * arenaOptions.maxGames / 2;
+		Arena arena(engines[0], engines[1], arenaOptions);
+		arena.Run();
+
+		float score = (float)(arena.win - arena.loss) / arenaOptions.maxGames;
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			// gradient estimate score / (2 * delta), the gain is in squared steps of the parameter
+			float gain = SPSA_RATE * powf(stability + 1, SPSA_ALPHA) * 2 * params[i].step * params[i].step;
+			if (deltas[i] != 0)
+				values[i] += gain / powf(k + 1 + stability, SPSA_ALPHA) * score / (2 * deltas[i]);
+			values[i] = min(max(values[i], params[i].minValue), params[i].maxValue);
+		}
+
+		printf("tune %d/%d: plus +%d -%d =%d, %s\n", k + 1, options.iterations, arena.win, arena.loss, arena.draw, FormatParams(values).c_str());
+		fflush(stdout);
+	}
+
+	return WriteConfig(values);
+}
+
+MCTSConfig Tuner::MakeConfig(const vector<float> &values)
+{
+	MCTSConfig config = baseConfig;
+	config.Parse(FormatParams(values));
+	return config;
+}
+
+string Tuner::FormatParams(const vector<float> &values)
+{
+	stringstream ss;
+	for (size_t i = 0; i < params.size(); ++i)
+	{
+		if (i > 0)
+			ss << ",";
+
+		ss << params[i].key << "=";
+		if (params[i].isInteger)
+			ss << (int)roundf(values[i]);
+		else
+			ss << values[i];
+	}
+	return ss.str();
+}
+
+bool Tuner::WriteConfig(const vector<float> &values)
+{
+	// the config is meant for the time and threads it was tuned with, later keys win
+	char tuned[64];
+	snprintf(tuned, sizeof(tuned), "time=%g,threads=%d,", options.searchTime, options.threadNum);
+	string text = (options.baseConfig.empty() ? "" : options.baseConfig + ",") + tuned + FormatParams(values);
+
+	FILE *fp;
+	if (fopen_s(&fp, options.outputFile.c_str(), "wb") != 0)
+	{
+		printf("tune: cannot write %s\n", options.outputFile.c_str());
+		return false;
+	}
+	fprintf(fp, "%s\n", text.c_str());
+	fclose(fp);
+
+	printf("tune: %s written to %s\n", text.c_str(), options.outputFile.c_str());
+	return true;
+}
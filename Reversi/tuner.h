@@ -0,0 +1,48 @@
+#pragma once
+#include "arena.h"
+
+class TuneOptions
+{
+public:
+	TuneOptions();
+	bool Set(const string &key, const string &value);
+
+	int iterations;
+	int gamesPerIteration;	// games between the two perturbed engines, rounded up to color pairs
+	float searchTime;		// time control the parameters are tuned for
+	int threadNum;			// search threads of one engine
+	int concurrency;		// games at the same time, 0: one per hardware thread / threadNum
+	string paramKeys;		// "cuct+fstop", empty: all tunable parameters
+	string baseConfig;		// engine config the values start from, time and threads are set above
+	string outputFile;		// tuned config is written here
+};
+
+// a search constant of MCTSConfig under tuning
+struct TuneParam
+{
+	string key;		// MCTSConfig key
+	float value;
+	float minValue, maxValue;
+	float step;		// perturbation at the first iteration
+	bool isInteger;
+};
+
+// Simultaneous perturbation stochastic approximation over the search constants.
+// Every iteration flips a random sign per parameter, plays value + step * sign
+// against value - step * sign in an arena, and moves the values along the signs
+// in proportion to the score. Perturbation and rate decay as in Spall's schedule.
+class Tuner
+{
+public:
+	Tuner(const TuneOptions &options);
+	bool Run();
+
+private:
+	MCTSConfig MakeConfig(const vector<float> &values);
+	string FormatParams(const vector<float> &values);
+	bool WriteConfig(const vector<float> &values);
+
+	TuneOptions options;
+	MCTSConfig baseConfig;
+	vector<TuneParam> params;
+};